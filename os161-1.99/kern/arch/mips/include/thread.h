@@ -42,6 +42,7 @@ typedef void (*badfaultfunc_t)(void);
 struct thread_machdep {
 	badfaultfunc_t tm_badfaultfunc;	/* fault hook used by copyin/out */
 	jmp_buf tm_copyjmp;		/* longjmp area used by copyin/out */
+	vaddr_t tm_usersp;		/* user sp at last trap from user mode */
 };
 
 
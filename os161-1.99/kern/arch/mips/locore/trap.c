@@ -148,6 +148,15 @@ mips_trap(struct trapframe *tf)
 						+ STACK_SIZE));
 	}
 
+	/*
+	 * Remember the user stack pointer; vm_fault goes by it to
+	 * decide whether the stack may grow, also for faults in
+	 * copyin/copyout during a system call.
+	 */
+	if (!iskern && curthread != NULL) {
+		curthread->t_machdep.tm_usersp = tf->tf_sp;
+	}
+
 	/* Interrupt? Call the interrupt handler and return. */
 	if (code == EX_IRQ) {
 		int old_in;
@@ -36,6 +36,7 @@
 #include <current.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <addrspace.h>
 #include <proc.h>
 /*
@@ -138,6 +139,36 @@ syscall(struct trapframe *tf)
 		err = sys_execv((char *)tf->tf_a0, (char **)tf->tf_a1);
 		break;
 #endif
+#if OPT_A3
+	case SYS_sbrk:
+		err = sys_sbrk((intptr_t)tf->tf_a0, &retval);
+		break;
+	case SYS_mmap:
+		err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+			       (int)tf->tf_a2, (int)tf->tf_a3,
+			       (userptr_t)(tf->tf_sp + 16), &retval);
+		break;
+	case SYS_munmap:
+		err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+		break;
+	case SYS___vmstats:
+		err = sys___vmstats((userptr_t)tf->tf_a0, (unsigned)tf->tf_a1,
+				    &retval);
+		break;
+	case SYS_open:
+		err = sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1, &retval);
+		break;
+	case SYS_close:
+		err = sys_close((int)tf->tf_a0);
+		break;
+	case SYS_read:
+		err = sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+			       (unsigned)tf->tf_a2, &retval);
+		break;
+	case SYS_fsync:
+		err = sys_fsync((int)tf->tf_a0);
+		break;
+#endif
 
 #endif // UW
 	    /* Add stuff here */
@@ -38,6 +38,9 @@
 #include <addrspace.h>
 #include <vm.h>
 #include "opt-A3.h"
+#if OPT_A3
+#include <coremap.h>
+#endif
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -49,15 +52,21 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+#if !OPT_A3
 /*
  * Wrap rma_stealmem in a spinlock.
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+#endif
 
 void
 vm_bootstrap(void)
 {
+#if OPT_A3
+	coremap_bootstrap();
+#else
 	/* Do nothing. */
+#endif
 }
 
 static
@@ -66,11 +75,16 @@ getppages(unsigned long npages)
 {
 	paddr_t addr;
 
+#if OPT_A3
+	/* the coremap does its own locking */
+	addr = coremap_alloc(npages);
+#else
 	spinlock_acquire(&stealmem_lock);
 
 	addr = ram_stealmem(npages);
 	
 	spinlock_release(&stealmem_lock);
+#endif
 	return addr;
 }
 
@@ -89,9 +103,14 @@ alloc_kpages(int npages)
 void 
 free_kpages(vaddr_t addr)
 {
+#if OPT_A3
+	KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+	coremap_free(addr - MIPS_KSEG0);
+#else
 	/* nothing - leak the memory. */
 
 	(void)addr;
+#endif
 }
 
 void
@@ -238,6 +257,18 @@ as_create(void)
 void
 as_destroy(struct addrspace *as)
 {
+#if OPT_A3
+	/* give the frames back; pbase is 0 if it was never allocated */
+	if (as->as_pbase1 != 0) {
+		coremap_free(as->as_pbase1);
+	}
+	if (as->as_pbase2 != 0) {
+		coremap_free(as->as_pbase2);
+	}
+	if (as->as_stackpbase != 0) {
+		coremap_free(as->as_stackpbase);
+	}
+#endif
 	kfree(as);
 }
 
@@ -128,7 +128,7 @@ emu_irq(void *dev)
 	sc->e_result = emu_rreg(sc, REG_RESULT);
 	emu_wreg(sc, REG_RESULT, 0);
 
-	V(sc->e_sem);
+	V(&sc->e_sem);
 }
 
 /*
@@ -166,7 +166,7 @@ static
 int
 emu_waitdone(struct emu_softc *sc)
 {
-	P(sc->e_sem);
+	P(&sc->e_sem);
 	return translate_err(sc, sc->e_result);
 }
 
@@ -202,7 +202,7 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 	/* mode isn't supported (yet?) */
 	(void)mode;
 
-	lock_acquire(sc->e_lock);
+	lock_acquire(&sc->e_lock);
 
 	strcpy(sc->e_iobuf, name);
 	emu_wreg(sc, REG_IOLEN, strlen(name));
@@ -215,7 +215,7 @@ emu_open(struct emu_softc *sc, uint32_t handle, const char *name,
 		*newisdir = emu_rreg(sc, REG_IOLEN)>0;
 	}
 
-	lock_release(sc->e_lock);
+	lock_release(&sc->e_lock);
 	return result;
 }
 
@@ -232,9 +232,9 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 	bool mine;
 	int retries = 0;
 
-	mine = lock_do_i_hold(sc->e_lock);
+	mine = lock_do_i_hold(&sc->e_lock);
 	if (!mine) {
-		lock_acquire(sc->e_lock);
+		lock_acquire(&sc->e_lock);
 	}
 
 	while (1) {
@@ -254,7 +254,7 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 	}
 
 	if (!mine) {
-		lock_release(sc->e_lock);
+		lock_release(&sc->e_lock);
 	}
 	return result;
 }
@@ -271,7 +271,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 	KASSERT(uio->uio_rw == UIO_READ);
 
-	lock_acquire(sc->e_lock);
+	lock_acquire(&sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
@@ -287,7 +287,7 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
 
  out:
-	lock_release(sc->e_lock);
+	lock_release(&sc->e_lock);
 	return result;
 }
 
@@ -325,7 +325,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
 
-	lock_acquire(sc->e_lock);
+	lock_acquire(&sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
@@ -340,7 +340,7 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	result = emu_waitdone(sc);
 
  out:
-	lock_release(sc->e_lock);
+	lock_release(&sc->e_lock);
 	return result;
 }
 
@@ -353,7 +353,7 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 {
 	int result;
 
-	lock_acquire(sc->e_lock);
+	lock_acquire(&sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_OPER, EMU_OP_GETSIZE);
@@ -362,7 +362,7 @@ emu_getsize(struct emu_softc *sc, uint32_t handle, off_t *retval)
 		*retval = emu_rreg(sc, REG_IOLEN);
 	}
 
-	lock_release(sc->e_lock);
+	lock_release(&sc->e_lock);
 	return result;
 }
 
@@ -375,14 +375,14 @@ emu_trunc(struct emu_softc *sc, uint32_t handle, off_t len)
 {
 	int result;
 
-	lock_acquire(sc->e_lock);
+	lock_acquire(&sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
 	emu_wreg(sc, REG_OPER, EMU_OP_TRUNC);
 	result = emu_waitdone(sc);
 
-	lock_release(sc->e_lock);
+	lock_release(&sc->e_lock);
 	return result;
 }
 
@@ -477,10 +477,10 @@ emufs_reclaim(struct vnode *v)
 	 */
 
 	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(&ef->ef_emu->e_lock);
 
 	if (ev->ev_v.vn_refcount != 1) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(&ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
@@ -488,7 +488,7 @@ emufs_reclaim(struct vnode *v)
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
 	if (result) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(&ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return result;
 	}
@@ -512,7 +512,7 @@ emufs_reclaim(struct vnode *v)
 	vnodearray_remove(ef->ef_vnodes, ix);
 	VOP_CLEANUP(&ev->ev_v);
 
-	lock_release(ef->ef_emu->e_lock);
+	lock_release(&ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
 	kfree(ev);
@@ -840,9 +840,11 @@ emufs_namefile(struct vnode *v, struct uio *uio)
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, off_t offset, paddr_t *ret)
 {
 	(void)v;
+	(void)offset;
+	(void)ret;
 	return EUNIMP;
 }
 
@@ -1059,6 +1061,16 @@ emufs_lookparent_notdir(struct vnode *v, char *pathname, struct vnode **result,
 }
 
 
+static
+int
+emufs_mmap_isdir(struct vnode *v, off_t offset, paddr_t *ret)
+{
+	(void)v;
+	(void)offset;
+	(void)ret;
+	return EISDIR;
+}
+
 static
 int
 emufs_truncate_isdir(struct vnode *v, off_t len)
@@ -1124,7 +1136,7 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_dir_gettype,
 	emufs_dir_tryseek,
 	emufs_void_op_isdir,  /* fsync */
-	emufs_void_op_isdir,  /* mmap */
+	emufs_mmap_isdir,
 	emufs_truncate_isdir,
 	emufs_namefile,
 
@@ -1154,7 +1166,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	int result;
 
 	vfs_biglock_acquire();
-	lock_acquire(ef->ef_emu->e_lock);
+	lock_acquire(&ef->ef_emu->e_lock);
 
 	num = vnodearray_num(ef->ef_vnodes);
 	for (i=0; i<num; i++) {
@@ -1165,7 +1177,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 			VOP_INCREF(&ev->ev_v);
 
-			lock_release(ef->ef_emu->e_lock);
+			lock_release(&ef->ef_emu->e_lock);
 			vfs_biglock_release();
 			*ret = ev;
 			return 0;
@@ -1176,7 +1188,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 
 	ev = kmalloc(sizeof(struct emufs_vnode));
 	if (ev==NULL) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(&ef->ef_emu->e_lock);
 		return ENOMEM;
 	}
 
@@ -1186,7 +1198,7 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	result = VOP_INIT(&ev->ev_v, isdir ? &emufs_dirops : &emufs_fileops,
 			   &ef->ef_fs, ev);
 	if (result) {
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(&ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		kfree(ev);
 		return result;
@@ -1196,13 +1208,13 @@ emufs_loadvnode(struct emufs_fs *ef, uint32_t handle, int isdir,
 	if (result) {
 		/* note: VOP_CLEANUP undoes VOP_INIT - it does not kfree */
 		VOP_CLEANUP(&ev->ev_v);
-		lock_release(ef->ef_emu->e_lock);
+		lock_release(&ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		kfree(ev);
 		return result;
 	}
 
-	lock_release(ef->ef_emu->e_lock);
+	lock_release(&ef->ef_emu->e_lock);
 	vfs_biglock_release();
 
 	*ret = ev;
@@ -1334,16 +1346,8 @@ config_emu(struct emu_softc *sc, int emuno)
 {
 	char name[32];
 
-	sc->e_lock = lock_create("emufs-lock");
-	if (sc->e_lock == NULL) {
-		return ENOMEM;
-	}
-	sc->e_sem = sem_create("emufs-sem", 0);
-	if (sc->e_sem == NULL) {
-		lock_destroy(sc->e_lock);
-		sc->e_lock = NULL;
-		return ENOMEM;
-	}
+	lock_init(&sc->e_lock, "emufs-lock");
+	sem_init(&sc->e_sem, "emufs-sem", 0);
 	sc->e_iobuf = bus_map_area(sc->e_busdata, sc->e_buspos, EMU_BUFFER);
 
 	snprintf(name, sizeof(name), "emu%d", emuno);
@@ -103,7 +103,7 @@ void
 lhd_iodone(struct lhd_softc *lh, int err)
 {
 	lh->lh_result = err;
-	V(lh->lh_done);
+	V(&lh->lh_done);
 }
 
 /*
@@ -229,7 +229,7 @@ lhd_io(struct device *d, struct uio *uio)
 	for (i=0; i<len; i++) {
 
 		/* Wait until nobody else is using the device. */
-		P(lh->lh_clear);
+		P(&lh->lh_clear);
 
 		/*
 		 * Are we writing? If so, transfer the data to the
@@ -238,7 +238,7 @@ lhd_io(struct device *d, struct uio *uio)
 		if (uio->uio_rw == UIO_WRITE) {
 			result = uiomove(lh->lh_buf, LHD_SECTSIZE, uio);
 			if (result) {
-				V(lh->lh_clear);
+				V(&lh->lh_clear);
 				return result;
 			}
 		}
@@ -250,7 +250,7 @@ lhd_io(struct device *d, struct uio *uio)
 		lhd_wreg(lh, LHD_REG_STAT, statval);
 
 		/* Now wait until the interrupt handler tells us we're done. */
-		P(lh->lh_done);
+		P(&lh->lh_done);
 
 		/* Get the result value saved by the interrupt handler. */
 		result = lh->lh_result;
@@ -264,7 +264,7 @@ lhd_io(struct device *d, struct uio *uio)
 		}
 
 		/* Tell another thread it's cleared to go ahead. */
-		V(lh->lh_clear);
+		V(&lh->lh_clear);
 
 		/* If we failed, return the error. */
 		if (result) {
@@ -289,17 +289,9 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
-	if (lh->lh_clear == NULL) {
-		return ENOMEM;
-	}
-	lh->lh_done = sem_create("lhd-done", 0);
-	if (lh->lh_done == NULL) {
-		sem_destroy(lh->lh_clear);
-		lh->lh_clear = NULL;
-		return ENOMEM;
-	}
+	/* Set up the semaphores. */
+	sem_init(&lh->lh_clear, "lhd-clear", 1);
+	sem_init(&lh->lh_done, "lhd-done", 0);
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
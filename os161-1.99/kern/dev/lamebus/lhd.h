@@ -31,6 +31,7 @@
 #define _LAMEBUS_LHD_H_
 
 #include <device.h>
+#include <synch.h>
 
 /*
  * Our sector size
@@ -52,8 +53,8 @@ struct lhd_softc {
 
 	void *lh_buf;			/* Pointer to on-card I/O buffer */
 	int lh_result;			/* Result from I/O operation */
-	struct semaphore *lh_clear;	/* Synchronization */
-	struct semaphore *lh_done;
+	struct semaphore lh_clear;	/* Synchronization */
+	struct semaphore lh_done;
 
 	struct device lh_dev;		/* VFS device structure */
 };
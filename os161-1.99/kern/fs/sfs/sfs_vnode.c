@@ -44,11 +44,25 @@
 #include <vfs.h>
 #include <device.h>
 #include <sfs.h>
+#include <kmemcache.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <pagecache.h>
+#endif
 
 /* At bottom of file */
 static int sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int type,
 			 struct sfs_vnode **ret);
 
+/*
+ * Cache of vnode structures, so files opened and closed over and over
+ * don't go through kmalloc every time. They are fully set up again
+ * by sfs_loadvnode, so there's no constructor.
+ */
+static struct kmem_cache sfs_vnode_cache =
+	KMEM_CACHE_INITIALIZER("sfs_vnode", sizeof(struct sfs_vnode),
+			       NULL, NULL, KC_MAXFREE);
+
 ////////////////////////////////////////////////////////////
 //
 // Simple stuff
@@ -541,6 +555,163 @@ sfs_io(struct sfs_vnode *sv, struct uio *uio)
 	return result;
 }
 
+#if OPT_A3
+
+/* Number of file blocks in a page. */
+#define SFS_PAGEBLOCKS	(PAGE_SIZE / SFS_BLOCKSIZE)
+
+/*
+ * Get the page of file SV that starts at OFFSET from the page cache,
+ * reading it in and caching it if it isn't there. Blocks the file
+ * doesn't have (holes, and anything past EOF) read as zeros. Hands
+ * back the frame with a reference to drop with pagecache_release.
+ */
+static
+int
+sfs_getpage(struct sfs_vnode *sv, off_t offset, paddr_t *ret)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	uint32_t fileblock, nblocks, diskblock, i;
+	vaddr_t kva;
+	char *buf;
+	paddr_t pa;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	pa = pagecache_get(&sv->sv_v, offset);
+	if (pa != 0) {
+		*ret = pa;
+		return 0;
+	}
+
+	kva = alloc_kpages(1);
+	if (kva == 0) {
+		return ENOMEM;
+	}
+
+	nblocks = DIVROUNDUP(sv->sv_i.sfi_size, SFS_BLOCKSIZE);
+	fileblock = offset / SFS_BLOCKSIZE;
+	for (i=0; i<SFS_PAGEBLOCKS; i++, fileblock++) {
+		buf = (char *)kva + i*SFS_BLOCKSIZE;
+		diskblock = 0;
+		if (fileblock < nblocks) {
+			result = sfs_bmap(sv, fileblock, 0, &diskblock);
+			if (result) {
+				free_kpages(kva);
+				return result;
+			}
+		}
+		if (diskblock == 0) {
+			bzero(buf, SFS_BLOCKSIZE);
+			continue;
+		}
+		result = sfs_rblock(sfs, buf, diskblock);
+		if (result) {
+			free_kpages(kva);
+			return result;
+		}
+	}
+
+	pa = KVADDR_TO_PADDR(kva);
+
+	/*
+	 * Once a file is deleted, caching it would only keep its blocks
+	 * from being freed when it's closed. And if the cache has no
+	 * memory for it, the page is used once and thrown away.
+	 */
+	if (sv->sv_i.sfi_linkcount > 0) {
+		pagecache_add(&sv->sv_v, offset, &pa);
+	}
+	*ret = pa;
+	return 0;
+}
+
+/*
+ * Do I/O on a regular file through the page cache, a page at a time.
+ * Writes go into the cached page and then straight on to disk, a
+ * block at a time, so the cache never holds anything the disk doesn't
+ * and evicting a page never needs I/O.
+ */
+static
+int
+sfs_cacheio(struct sfs_vnode *sv, struct uio *uio)
+{
+	struct sfs_fs *sfs = sv->sv_v.vn_fs->fs_data;
+	off_t pageoff, size;
+	uint32_t skip, len, b, diskblock;
+	paddr_t pa;
+	char *kva;
+	int result = 0, result2;
+
+	/* Let go of any files whose last cached pages were evicted. */
+	pagecache_reap();
+
+	while (uio->uio_resid > 0) {
+		size = sv->sv_i.sfi_size;
+		if (uio->uio_rw == UIO_READ && uio->uio_offset >= size) {
+			/* At or past EOF */
+			break;
+		}
+
+		pageoff = uio->uio_offset - uio->uio_offset % PAGE_SIZE;
+		skip = uio->uio_offset - pageoff;
+		len = PAGE_SIZE - skip;
+		if (len > uio->uio_resid) {
+			len = uio->uio_resid;
+		}
+		if (uio->uio_rw == UIO_READ && uio->uio_offset + len > size) {
+			len = size - uio->uio_offset;
+		}
+
+		result = sfs_getpage(sv, pageoff, &pa);
+		if (result) {
+			break;
+		}
+		kva = (char *)PADDR_TO_KVADDR(pa);
+
+		result = uiomove(kva + skip, len, uio);
+
+		/*
+		 * If writing, write back every block the write covered,
+		 * even if uiomove failed partway, so the disk ends up
+		 * with whatever the page has.
+		 */
+		if (uio->uio_rw == UIO_WRITE) {
+			for (b = skip / SFS_BLOCKSIZE;
+			     b < DIVROUNDUP(skip + len, SFS_BLOCKSIZE); b++) {
+				result2 = sfs_bmap(sv,
+						   pageoff/SFS_BLOCKSIZE + b,
+						   1, &diskblock);
+				if (result2 == 0) {
+					result2 = sfs_wblock(sfs,
+						kva + b*SFS_BLOCKSIZE,
+						diskblock);
+				}
+				if (result2) {
+					if (result == 0) {
+						result = result2;
+					}
+					break;
+				}
+			}
+			if (uio->uio_offset > size) {
+				sv->sv_i.sfi_size = uio->uio_offset;
+				sv->sv_dirty = true;
+			}
+		}
+
+		pagecache_release(pa);
+		if (result) {
+			break;
+		}
+	}
+
+	return result;
+}
+
+#endif /* OPT_A3 */
+
 ////////////////////////////////////////////////////////////
 //
 // Directory I/O
@@ -953,14 +1124,15 @@ sfs_reclaim(struct vnode *v)
 	vfs_biglock_release();
 
 	/* Release the storage for the vnode structure itself. */
-	kfree(sv);
+	kmem_cache_free(&sfs_vnode_cache, sv);
 
 	/* Done */
 	return 0;
 }
 
 /*
- * Called for read(). sfs_io() does the work.
+ * Called for read(). sfs_io() does the work, or with the page cache,
+ * sfs_cacheio().
  */
 static
 int
@@ -972,14 +1144,19 @@ sfs_read(struct vnode *v, struct uio *uio)
 	KASSERT(uio->uio_rw==UIO_READ);
 
 	vfs_biglock_acquire();
+#if OPT_A3
+	result = sfs_cacheio(sv, uio);
+#else
 	result = sfs_io(sv, uio);
+#endif
 	vfs_biglock_release();
 
 	return result;
 }
 
 /*
- * Called for write(). sfs_io() does the work.
+ * Called for write(). sfs_io() does the work, or with the page cache,
+ * sfs_cacheio().
  */
 static
 int
@@ -991,7 +1168,11 @@ sfs_write(struct vnode *v, struct uio *uio)
 	KASSERT(uio->uio_rw==UIO_WRITE);
 
 	vfs_biglock_acquire();
+#if OPT_A3
+	result = sfs_cacheio(sv, uio);
+#else
 	result = sfs_io(sv, uio);
+#endif
 	vfs_biglock_release();
 
 	return result;
@@ -1110,14 +1291,29 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called by the VM system to map a page of a file. The frame comes
+ * straight from the page cache.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, off_t offset, paddr_t *ret)
 {
+#if OPT_A3
+	struct sfs_vnode *sv = v->vn_data;
+	int result;
+
+	vfs_biglock_acquire();
+	pagecache_reap();
+	result = sfs_getpage(sv, offset, ret);
+	vfs_biglock_release();
+
+	return result;
+#else
 	(void)v;
+	(void)offset;
+	(void)ret;
 	return EUNIMP;
+#endif
 }
 
 /*
@@ -1214,6 +1410,30 @@ sfs_truncate(struct vnode *v, off_t len)
 		}
 	}
 
+#if OPT_A3
+	/*
+	 * Zero the rest of the new last block, on disk and in the page
+	 * cache, so if the file grows again the gap reads as zeros
+	 * whether or not its page stays cached meanwhile.
+	 */
+	if (len % SFS_BLOCKSIZE != 0) {
+		result = sfs_bmap(sv, len / SFS_BLOCKSIZE, 0, &block);
+		if (result == 0 && block != 0) {
+			result = sfs_rblock(sfs, idbuf, block);
+			if (result == 0) {
+				bzero((char *)idbuf + len % SFS_BLOCKSIZE,
+				      SFS_BLOCKSIZE - len % SFS_BLOCKSIZE);
+				result = sfs_wblock(sfs, idbuf, block);
+			}
+		}
+		if (result) {
+			vfs_biglock_release();
+			return result;
+		}
+	}
+	pagecache_truncate(v, len);
+#endif
+
 	/* Set the file size */
 	sv->sv_i.sfi_size = len;
 
@@ -1376,6 +1596,12 @@ sfs_remove(struct vnode *dir, const char *name)
 		KASSERT(victim->sv_i.sfi_linkcount > 0);
 		victim->sv_i.sfi_linkcount--;
 		victim->sv_dirty = true;
+#if OPT_A3
+		/* Don't let the page cache keep it from being reclaimed */
+		if (victim->sv_i.sfi_linkcount == 0) {
+			pagecache_purge(&victim->sv_v);
+		}
+#endif
 	}
 
 	/* Discard the reference that sfs_lookonce got us */
@@ -1685,7 +1911,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 
 	/* Didn't have it loaded; load it */
 
-	sv = kmalloc(sizeof(struct sfs_vnode));
+	sv = kmem_cache_alloc(&sfs_vnode_cache);
 	if (sv==NULL) {
 		return ENOMEM;
 	}
@@ -1699,7 +1925,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Read the block the inode is in */
 	result = sfs_rblock(sfs, &sv->sv_i, ino);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1736,7 +1962,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	/* Call the common vnode initializer */
 	result = VOP_INIT(&sv->sv_v, ops, &sfs->sfs_absfs, sv);
 	if (result) {
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -1747,7 +1973,7 @@ sfs_loadvnode(struct sfs_fs *sfs, uint32_t ino, int forcetype,
 	result = vnodearray_add(sfs->sfs_vnodes, &sv->sv_v, NULL);
 	if (result) {
 		VOP_CLEANUP(&sv->sv_v);
-		kfree(sv);
+		kmem_cache_free(&sfs_vnode_cache, sv);
 		return result;
 	}
 
@@ -36,8 +36,12 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
+#include <synch.h>
+#include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
 
 
 /* 
@@ -47,6 +51,7 @@ struct vnode;
  * You write this.
  */
 
+#if OPT_DUMBVM
 struct addrspace {
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -56,6 +61,149 @@ struct addrspace {
   size_t as_npages2;
   paddr_t as_stackpbase;
 };
+#else
+
+/*
+ * The user stack starts out big enough for the program's arguments
+ * (ARG_MAX), and grows down on faults at or no more than
+ * VM_STACKGROW_SLACK bytes below the faulting thread's stack pointer,
+ * until it reaches the stack size limit (RLIMIT_STACK, in bytes) in
+ * force when the address space was set up. The page below that is
+ * never mapped.
+ */
+#define VM_STACKLIMIT_DEFAULT  (1024 * 1024)
+#define VM_STACKLIMIT_MAX      (16 * 1024 * 1024)
+#define VM_STACKGROW_SLACK     256
+
+/* Most cpus an address space can have an ASID on: one per LAMEbus slot */
+#define AS_MAXCPUS       32
+
+/* Region permission bits (vr_flags) */
+#define VR_READ    0x1
+#define VR_WRITE   0x2
+#define VR_EXEC    0x4
+#define VR_SHARED  0x8   /* mmap MAP_SHARED: shared with children and file */
+#define VR_MMAP    0x10  /* made by mmap, and can be unmapped */
+
+/*
+ * A region is a page-aligned range of the address space defined by
+ * as_define_region or as_define_stack. Pages inside a region get a
+ * frame the first time they are touched. If the region has a backing
+ * vnode (an ELF segment), the bytes from vr_fileva to vr_fileva +
+ * vr_filesize are read from the file at vr_offset when their page is
+ * first touched; everything else is zero-filled. Pages of read-only
+ * ELF segments that are all file data go through the page cache and
+ * are shared with every other process running the same program.
+ *
+ * A region mmap makes of a file maps the page cache's frames too,
+ * from vr_offset on: copy-on-write if the mapping is private and
+ * writable, and as they are if it is shared, so that writes through
+ * it go straight into the cached file. A shared page that has been
+ * written is marked PTE_DIRTY until it is written back to the file.
+ *
+ * The vr_fa_* fields belong to the fault-around code in vm/vm.c and
+ * are protected by the address space's as_lock.
+ */
+struct vm_region {
+  vaddr_t vr_base;              /* first address, page aligned */
+  size_t vr_npages;             /* length in pages */
+  unsigned vr_flags;            /* VR_* */
+  struct vnode *vr_vnode;       /* backing file, or NULL */
+  off_t vr_offset;              /* file offset of vr_fileva */
+  vaddr_t vr_fileva;            /* where the file data starts */
+  size_t vr_filesize;           /* bytes of file data */
+  vaddr_t vr_fa_start;          /* pages preloaded by the last fault */
+  vaddr_t vr_fa_end;            /*   (vm_faultaround) */
+  unsigned vr_fa_window;        /* pages to preload next time */
+  struct vm_region *vr_next;
+};
+
+/* File offset of the page at VADDR in file-backed region VR */
+#define VR_FILEOFF(vr, vaddr) \
+  ((vr)->vr_offset + ((off_t)(vaddr) - (off_t)(vr)->vr_fileva))
+
+/*
+ * as_lock serializes changes to the page table by the address space's
+ * owner: faults, as_copy, as_destroy, unmapping and write-back. Page
+ * replacement doesn't take it; see vm/vm.c.
+ */
+struct addrspace {
+  struct vm_region *as_regions; /* unordered list of regions */
+  struct pagetable *as_pt;      /* resident pages */
+  struct lock as_lock;          /* for as_pt */
+  struct vm_region *as_heap;    /* sbrk region, or NULL before loading */
+  vaddr_t as_heaptop;           /* current break, inside or at end of it */
+  struct vm_region *as_stack;   /* stack region, or NULL before it's set up */
+  size_t as_stackmax;           /* pages the stack may grow to */
+  uint32_t as_asid[AS_MAXCPUS]; /* ASID and generation on each cpu */
+  struct spinlock as_tlblock;   /* for as_asid and cpus' c_curas */
+};
+
+/*
+ * as_find_region - return the region containing VADDR, or NULL.
+ *
+ * as_tlbpid - the TLB PID that AS uses on the current cpu, or -1 if
+ *                it has none (and so cannot have anything in this
+ *                cpu's TLB). Call with interrupts off.
+ *
+ * as_tlbshootdown - remove the TLB entries for the N pages at VADDRS
+ *                in AS on every cpu. Only cpus currently using AS get
+ *                an IPI, one for the whole batch; the rest just forget
+ *                AS's ASID. If WAIT is set, returns only once every
+ *                cpu has done it.
+ *
+ * as_define_file - make the region containing VADDR load FILESIZE
+ *                bytes at VADDR from file V at OFFSET on demand. The
+ *                region keeps V open until the address space is
+ *                destroyed.
+ *
+ * as_sbrk - move the break of AS's heap by AMOUNT bytes (which may be
+ *                negative) and hand back the old one. Pages given
+ *                back are freed at once.
+ *
+ * as_growstack - if VADDR is below AS's stack but within its size
+ *                limit, and not too far below SP, the user stack
+ *                pointer, extend the stack down to it and return the
+ *                stack region. Otherwise return NULL.
+ *
+ * as_set_stacklimit, as_get_stacklimit - the stack size limit, in
+ *                bytes, for address spaces set up from now on.
+ *
+ * as_mmap - map LEN bytes into AS with PROT_* permissions PROT,
+ *                MAP_SHARED or MAP_PRIVATE according to FLAGS: of
+ *                file V from OFFSET (page aligned) on, or of zero-
+ *                filled memory if V is NULL. The pages of a shared
+ *                mapping stay shared with the children it is copied
+ *                to by fork, and those of a shared file mapping with
+ *                the file. The mapping keeps V open until it is
+ *                unmapped. It goes below the space reserved for the
+ *                stack, wherever there's room; its address is handed
+ *                back in RET.
+ *
+ * as_munmap - remove the mapping at VADDR, which must be all of one
+ *                made by as_mmap, writing back a shared file
+ *                mapping's dirty pages first.
+ *
+ * as_sync - write back the dirty pages of AS's shared mappings of file
+ *                V, or of every file if V is NULL. as_destroy does
+ *                this for all of them.
+ */
+struct vm_region *as_find_region(struct addrspace *as, vaddr_t vaddr);
+int as_tlbpid(struct addrspace *as);
+void as_tlbshootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned n,
+                     bool wait);
+int as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+                   off_t offset, size_t filesize);
+int as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak);
+struct vm_region *as_growstack(struct addrspace *as, vaddr_t vaddr,
+                               vaddr_t sp);
+void as_set_stacklimit(size_t bytes);
+size_t as_get_stacklimit(void);
+int as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+            struct vnode *v, off_t offset, vaddr_t *ret);
+int as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len);
+int as_sync(struct addrspace *as, struct vnode *v);
+#endif /* OPT_DUMBVM */
 
 /*
  * Functions in addrspace.c:
@@ -50,6 +50,12 @@
  * returns the actual length of string found in GOT. DEST is always
  * null-terminated on success. LEN and GOT include the null terminator.
  *
+ * copyinv and copyoutv are like copyin and copyout, but copy a batch
+ * of NVEC buffers, each described by a struct copyvec. All of the
+ * user addresses are checked before anything is copied, and the
+ * recovery from bad addresses is set up only once, which is cheaper
+ * than many separate calls when the buffers are small.
+ *
  * All of these functions return 0 on success, EFAULT if a memory
  * addressing error was encountered, or (for the string versions)
  * ENAMETOOLONG if the space available was insufficient.
@@ -69,5 +75,14 @@ int copyout(const void *src, userptr_t userdest, size_t len);
 int copyinstr(const_userptr_t usersrc, char *dest, size_t len, size_t *got);
 int copyoutstr(const char *src, userptr_t userdest, size_t len, size_t *got);
 
+struct copyvec {
+	void *cv_kaddr;		/* kernel buffer */
+	userptr_t cv_uaddr;	/* user buffer */
+	size_t cv_len;		/* length of both */
+};
+
+int copyinv(const struct copyvec *vec, unsigned nvec);
+int copyoutv(const struct copyvec *vec, unsigned nvec);
+
 
 #endif /* _COPYINOUT_H_ */
@@ -0,0 +1,87 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+/*
+ * Physical page frame allocator.
+ *
+ * The coremap is an array with one entry for every physical page
+ * frame that ram_getsize() hands to the VM system. It is built once,
+ * in vm_bootstrap(), and lives in the first few frames of that memory.
+ *
+ * Functions:
+ *
+ *    coremap_bootstrap - take over the memory not already claimed by
+ *                ram_stealmem() and build the coremap. Before this
+ *                is called, coremap_alloc falls back to ram_stealmem
+ *                and coremap_free leaks.
+ *
+ *    coremap_alloc - allocate NPAGES physically contiguous frames.
+ *                Returns the physical address of the first one, or
+ *                0 if there isn't enough memory.
+ *
+ *    coremap_free - release a run of frames previously returned by
+ *                coremap_alloc. PADDR must be the address that
+ *                coremap_alloc handed back. Frames that were stolen
+ *                before coremap_bootstrap are silently ignored.
+ *
+ *    coremap_incref, coremap_decref - add or drop a reference to a
+ *                single frame shared between address spaces. A frame
+ *                comes from coremap_alloc(1) with one reference, and
+ *                coremap_decref frees it when the count reaches 0.
+ *
+ *    coremap_refcount - current number of references to a frame.
+ *
+ *    coremap_touch - set a frame's reference bit, noting that AS
+ *                maps it at VADDR. A frame with a single reference
+ *                becomes a candidate for eviction until its reference
+ *                count next changes.
+ *
+ *    coremap_clock_victim - pick a pageable frame to evict with the
+ *                clock algorithm, mark it busy, and return it along
+ *                with its owner. Returns 0 if there is nothing that
+ *                can be evicted.
+ *
+ *    coremap_pin - mark busy the frame that PTE maps, so that it can't
+ *                be chosen as a victim and the PTE can't change under
+ *                the caller, and return it. If the frame is already
+ *                busy (on its way out to swap, say), waits until it
+ *                isn't and looks at the PTE again. Returns 0 if the
+ *                PTE doesn't map a frame. Only for the address space's
+ *                owner, holding its lock; may sleep.
+ *
+ *    coremap_busy - whether a frame is busy right now.
+ *
+ *    coremap_unbusy - unpin a frame, or put back a victim that was not
+ *                evicted after all.
+ *
+ *    coremap_decref_busy - like coremap_decref, for a frame the caller
+ *                has busy; it stops being busy at the same time.
+ *
+ *    coremap_freecount - number of frames free in the buddy system
+ *                (not counting those cached per-cpu).
+ *
+ *    coremap_printstats - print the number of free blocks of each
+ *                order in the buddy allocator (menu command "cm").
+ */
+
+#include <vm.h>
+#include <pagetable.h>
+
+struct addrspace;
+
+void coremap_bootstrap(void);
+paddr_t coremap_alloc(unsigned long npages);
+void coremap_free(paddr_t paddr);
+void coremap_incref(paddr_t paddr);
+void coremap_decref(paddr_t paddr);
+unsigned coremap_refcount(paddr_t paddr);
+void coremap_touch(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+paddr_t coremap_clock_victim(struct addrspace **asp, vaddr_t *vaddrp);
+paddr_t coremap_pin(const pte_t *pte);
+bool coremap_busy(paddr_t paddr);
+void coremap_unbusy(paddr_t paddr);
+void coremap_decref_busy(paddr_t paddr);
+unsigned long coremap_freecount(void);
+void coremap_printstats(void);
+
+#endif /* _COREMAP_H_ */
@@ -34,6 +34,31 @@
 #include <spinlock.h>
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include <kern/vmstats.h>  /* for VMSTAT_COUNT */
+#include "opt-A3.h"
+
+struct addrspace;
+
+/*
+ * Per-cpu magazines of free kmalloc blocks (see vm/kmalloc.c): one
+ * per size class, how many blocks each holds, and how many move
+ * between it and the shared page lists at a time.
+ */
+#define CPU_KMAG_NSIZES    8
+#define CPU_KMAG_SIZE      16
+#define CPU_KMAG_BATCH     8
+
+#if OPT_A3
+/*
+ * Size of the per-cpu cache of free page frames, and how many frames
+ * move between it and the coremap at a time.
+ */
+#define CPU_PAGEMAG_SIZE   32
+#define CPU_PAGEMAG_BATCH  16
+
+/* Entries in each cpu's software TLB; must be a power of 2. */
+#define CPU_STLB_SIZE      256
+#endif
 
 
 /*
@@ -61,6 +86,54 @@ struct cpu {
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 
+	/*
+	 * VM statistics (see vm/uw-vmstats.c). Only written by this
+	 * cpu, with interrupts off; read by anyone.
+	 */
+	unsigned c_vmstats[VMSTAT_COUNT];
+
+	/*
+	 * Free kmalloc blocks of each size owned by this cpu (see
+	 * vm/kmalloc.c). Only touched by this cpu, with interrupts off.
+	 */
+	void *c_kmag[CPU_KMAG_NSIZES][CPU_KMAG_SIZE];
+	unsigned c_kmag_count[CPU_KMAG_NSIZES];
+#if OPT_A3
+	/*
+	 * Free single frames owned by this cpu (see vm/coremap.c).
+	 * Only used by this cpu, except when another one drains it;
+	 * c_pagemag_lock is for that.
+	 */
+	struct spinlock c_pagemag_lock;
+	paddr_t c_pagemag[CPU_PAGEMAG_SIZE];
+	unsigned c_pagemag_count;
+
+	/*
+	 * TLB address space IDs (see vm/addrspace.c). c_asid is the
+	 * last one handed out, with the generation in the upper bits;
+	 * c_tlbpid is the one in use right now.
+	 * Only touched by this cpu, with interrupts off.
+	 */
+	uint32_t c_asid;
+	uint32_t c_tlbpid;
+
+	/*
+	 * Software TLB (see vm/vm.c): a direct-mapped cache of the
+	 * EntryHi/EntryLo pairs loaded into this cpu's TLB, kept
+	 * after the hardware replaces them.
+	 * Only touched by this cpu, with interrupts off.
+	 */
+	uint32_t c_stlb_hi[CPU_STLB_SIZE];
+	uint32_t c_stlb_lo[CPU_STLB_SIZE];
+
+	/*
+	 * The address space whose PID is in use. Other cpus read it
+	 * to decide whether a TLB shootdown needs an IPI; it is set
+	 * with that address space's as_tlblock held.
+	 */
+	struct addrspace *c_curas;
+#endif
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
@@ -82,10 +155,16 @@ struct cpu {
 	 * struct tlbshootdown is machine-dependent and might
 	 * reasonably be either an address space and vaddr pair, or a
 	 * paddr, or something else.
+	 *
+	 * Each batch of shootdowns queued gets a ticket number from
+	 * c_shootdown_sent; c_shootdown_done is the last ticket whose
+	 * shootdowns this cpu has finished.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	int c_numshootdown;
+	unsigned c_shootdown_sent;
+	unsigned c_shootdown_done;
 	struct spinlock c_ipi_lock;
 };
 
@@ -152,6 +231,11 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_many queues N shootdowns with a single IPI. Both
+ * return a ticket that ipi_tlbshootdown_wait can use to wait until the
+ * target has done them.
+ *
+ * cpu_bynumber returns the cpu whose c_number is NUM, or NULL.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -165,7 +249,13 @@ void cpu_halt(void);
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
-void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown(struct cpu *target,
+			  const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_many(struct cpu *target,
+			       const struct tlbshootdown *mappings, unsigned n);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
+
+struct cpu *cpu_bynumber(unsigned num);
 
 void interprocessor_interrupt(void);
 
@@ -0,0 +1,75 @@
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and the per-process file table.
+ *
+ * An open file is a vnode opened with one access mode and a seek
+ * position. File handles in a process's table refer to open files;
+ * fork copies the table, so parent and child share the open files (and
+ * so their seek positions) the way they would after dup.
+ *
+ * File handles 0, 1 and 2 are always the console, which every process
+ * gets by itself in proc_create_runprogram; the table only has the
+ * files a process opens itself, from handle 3 up.
+ *
+ * of_lock serializes I/O through the open file, which has to update
+ * of_offset. The reference count is under of_countlock rather than
+ * of_lock, since fork copies the table with interrupts off.
+ */
+
+#include <spinlock.h>
+#include <synch.h>
+#include <limits.h>
+
+struct vnode;
+struct proc;
+
+/* First file handle that isn't the console */
+#define FILE_FIRSTFD	3
+
+struct openfile {
+	struct vnode *of_vnode;		/* the file */
+	int of_accmode;			/* O_RDONLY, O_WRONLY or O_RDWR */
+	bool of_append;			/* O_APPEND */
+	struct lock of_lock;		/* for of_offset */
+	off_t of_offset;		/* seek position */
+	struct spinlock of_countlock;	/* for of_refcount */
+	unsigned of_refcount;		/* file table entries */
+};
+
+/*
+ * file_open - open the file named PATH (a kernel string) with O_*
+ *                flags FLAGS and hand back an open file with one
+ *                reference.
+ *
+ * file_incref, file_decref - take or drop a reference to an open
+ *                file. The file is closed when the last one goes.
+ *
+ * filetable_add - put OF in a free slot of PROC's table, taking over
+ *                the caller's reference, and hand back the handle.
+ *                EMFILE if the table is full.
+ *
+ * filetable_get - the open file PROC has as FD, or NULL if it is not
+ *                a handle for an open file. The file stays open as
+ *                long as the handle does, so this takes no reference.
+ *
+ * filetable_remove - take FD out of PROC's table and hand back its open
+ *                file, with the table's reference, or NULL.
+ *
+ * filetable_copy - give NEWPROC all of OLDPROC's open files. Doesn't
+ *                sleep.
+ *
+ * filetable_closeall - close everything in PROC's table.
+ */
+int file_open(char *path, int flags, struct openfile **ret);
+void file_incref(struct openfile *of);
+void file_decref(struct openfile *of);
+
+int filetable_add(struct proc *proc, struct openfile *of, int *fd);
+struct openfile *filetable_get(struct proc *proc, int fd);
+struct openfile *filetable_remove(struct proc *proc, int fd);
+void filetable_copy(struct proc *oldproc, struct proc *newproc);
+void filetable_closeall(struct proc *proc);
+
+#endif /* _FILE_H_ */
@@ -0,0 +1,44 @@
+#ifndef _KERN_VMSTATS_H_
+#define _KERN_VMSTATS_H_
+
+/*
+ * Virtual memory statistics, shared by the kernel (see uw-vmstats.h)
+ * and user programs, which read them with __vmstats().
+ *
+ * __vmstats(counts, n) copies the first n counters (at most
+ * VMSTAT_COUNT) into counts[] and returns VMSTAT_COUNT. The counters
+ * count up from boot (or from the last vmstats_init) and wrap, so
+ * take the difference of two snapshots to measure something.
+ *
+ * Every TLB fault is counted as exactly one of a TLB reload, a page
+ * cache hit, a zeroed page fault or a disk page fault. Page cache hits
+ * and misses count only faults on program text and mmap'd files, not
+ * file reads.
+ */
+
+/* DO NOT ADD OR CHANGE WITHOUT ALSO CHANGING stats_names in uw-vmstats.c */
+#define VMSTAT_TLB_FAULT              (0)
+#define VMSTAT_TLB_FAULT_FREE         (1)
+#define VMSTAT_TLB_FAULT_REPLACE      (2)
+#define VMSTAT_TLB_INVALIDATE         (3)
+#define VMSTAT_TLB_RELOAD             (4)
+#define VMSTAT_PAGE_FAULT_ZERO        (5)
+#define VMSTAT_PAGE_FAULT_DISK        (6)
+#define VMSTAT_ELF_FILE_READ          (7)
+#define VMSTAT_SWAP_FILE_READ         (8)
+#define VMSTAT_SWAP_FILE_WRITE        (9)
+#define VMSTAT_TLB_INVALIDATE_AVOIDED (10)
+#define VMSTAT_SHOOTDOWN_IPI         (11)
+#define VMSTAT_SHOOTDOWN_PAGE        (12)
+#define VMSTAT_PRELOAD_HIT           (13)
+#define VMSTAT_PRELOAD_MISS          (14)
+#define VMSTAT_COW_COPY              (15)
+#define VMSTAT_COW_REUSE             (16)
+#define VMSTAT_SWAP_FREE             (17)
+#define VMSTAT_SWAP_FULL             (18)
+#define VMSTAT_PAGECACHE_HIT         (19)
+#define VMSTAT_PAGECACHE_MISS        (20)
+#define VMSTAT_ZERO_BREAK            (21)
+#define VMSTAT_COUNT                 (22)
+
+#endif /* _KERN_VMSTATS_H_ */
@@ -0,0 +1,92 @@
+#ifndef _KMEMCACHE_H_
+#define _KMEMCACHE_H_
+
+/*
+ * Object caches: kmalloc for objects of one fixed size and type,
+ * that remembers what it handed out.
+ *
+ * A cache can have a constructor, which is run on an object when it
+ * is first allocated, and a destructor, which is run on it when the
+ * cache finally gives it back to kmalloc. In between, objects freed
+ * to the cache are kept on a free list, still constructed, and handed
+ * out again by the next allocation without running the constructor.
+ * So the expensive part of setting up an object (its wait channel,
+ * say, or its stack) is paid once, not on every create/destroy cycle.
+ *
+ * This means an object must be freed in its constructed state: the
+ * same state the constructor left it in, as far as the fields the
+ * constructor sets up are concerned. Fields the constructor doesn't
+ * touch are up to the caller to initialize on every allocation.
+ *
+ * At most KC_MAXFREE of a cache's objects (fewer if its own limit is
+ * smaller) are kept free; past that, freed objects are destroyed.
+ *
+ * Caches are usually static, set up with KMEM_CACHE_INITIALIZER, so
+ * they can be used from the first moment of boot without anyone
+ * having to create them. kmem_cache_create makes one dynamically.
+ *
+ * Functions:
+ *
+ *    kmem_cache_create  - make a cache named NAME of objects of SIZE
+ *                         bytes. CTOR and DTOR may be NULL. The name
+ *                         is not copied. Returns NULL if out of memory.
+ *
+ *    kmem_cache_destroy - destroy a dynamically created cache. All its
+ *                         objects must already have been freed.
+ *
+ *    kmem_cache_alloc   - allocate an object. Returns NULL if out of
+ *                         memory or if the constructor failed.
+ *
+ *    kmem_cache_free    - give back an object, in its constructed
+ *                         state.
+ *
+ *    kmem_cache_reap    - destroy all of a cache's free objects.
+ *
+ *    kmem_cache_reapall - destroy free objects of every cache, a
+ *                         batch at a time, for when memory runs out.
+ *                         May sleep. Returns how many it destroyed, so
+ *                         0 means there are none left.
+ *
+ *    kmem_cache_printstats - print the state of every cache that has
+ *                         been used.
+ */
+
+#include <spinlock.h>
+
+/* Most free objects any cache will keep. */
+#define KC_MAXFREE	16
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;			/* object size */
+	int (*kc_ctor)(void *obj);	/* returns an error code */
+	void (*kc_dtor)(void *obj);
+	unsigned kc_maxfree;		/* at most KC_MAXFREE */
+
+	struct spinlock kc_lock;	/* protects everything below */
+	unsigned kc_nfree;		/* number of entries in kc_free */
+	void *kc_free[KC_MAXFREE];	/* constructed, unused objects */
+	unsigned kc_ninuse;		/* objects allocated and not freed */
+	unsigned kc_nallocs;		/* calls to kmem_cache_alloc */
+	unsigned kc_nhits;		/* ...satisfied from kc_free */
+	bool kc_listed;			/* on the list of all caches */
+	struct kmem_cache *kc_next;	/* list of all caches */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor, maxfree) \
+	{ name, size, ctor, dtor, maxfree, SPINLOCK_INITIALIZER, \
+	  0, { NULL }, 0, 0, 0, false, NULL }
+
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void kmem_cache_reap(struct kmem_cache *kc);
+unsigned kmem_cache_reapall(void);
+
+void kmem_cache_printstats(void);
+
+#endif /* _KMEMCACHE_H_ */
@@ -122,11 +122,22 @@ uint32_t random(void);
 /*
  * Kernel heap memory allocation. Like malloc/free.
  * If out of memory, kmalloc returns NULL.
+ *
+ * kmalloc_at is kmalloc for wrappers around it: SITE, the wrapper's
+ * own return address, is the call site the kmalloc profiler charges
+ * the allocation to.
  */
 void *kmalloc(size_t size);
+void *kmalloc_at(size_t size, vaddr_t site);
 void kfree(void *ptr);
 void kheap_printstats(void);
 
+/*
+ * Print the N call sites of kmalloc with the most bytes live, or the
+ * highest high-water marks. Only in kernels with options kmallocprof.
+ */
+void kheap_printsites(unsigned n, bool byhighwater);
+
 /*
  * C string functions. 
  *
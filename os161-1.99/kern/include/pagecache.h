@@ -0,0 +1,99 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Page cache: frames holding a page of a file, found by (vnode, file
+ * offset of the first byte of the page). File systems that use it
+ * (SFS, for regular files) read and write file data through it, so a
+ * file read twice is only read from disk once, and the fault handler
+ * maps its frames (got through VOP_MMAP) directly into read-only
+ * program text, so processes running the same program share them, and
+ * into mmap'd files.
+ *
+ * The cache holds a reference to each frame it caches, and one to the
+ * vnode for each page of it, so a file's pages outlive its being open.
+ * A frame's other references are page table entries mapping it (each
+ * marked PTE_PCACHE) and file system code copying in or out of it.
+ *
+ * Cached pages are always the same as the file on disk, except where
+ * shared file mappings have written to them: the file system writes
+ * changes through to disk before it lets go of the page, and pages
+ * mapped shared stay cached until the VM system has written them back
+ * (see as_sync) and unmapped them. So evicting one never needs I/O.
+ * Pages are kept on an LRU list; when memory runs out vm_pageout calls pagecache_reclaim
+ * before it evicts anything else. Pages nobody has mapped go first,
+ * since only dropping those frees anything. A page that is still
+ * mapped when it is dropped stays mapped, and becomes an ordinary
+ * candidate for page replacement.
+ *
+ * Functions:
+ *
+ *    pagecache_get - if the page of V at OFFSET is cached, take
+ *                another reference to its frame and return it.
+ *                Otherwise return 0. Callers count hits and misses
+ *                themselves, if they want them counted.
+ *
+ *    pagecache_add - cache the frame *PA, already filled with the page
+ *                of V at OFFSET. The caller keeps its own reference.
+ *                If someone else cached that page meanwhile, *PA is
+ *                freed and replaced with a new reference to theirs.
+ *                Returns false if there was no memory to cache it, in
+ *                which case *PA is left alone and stays private.
+ *
+ *    pagecache_release - drop a reference taken by one of the above.
+ *
+ *    pagecache_release_busy - likewise, for a frame that the caller has
+ *                busy (see coremap_pin); it stops being busy too.
+ *
+ *    pagecache_share - count another shared mapping of the frame PA,
+ *                if it is still the cached page of V at OFFSET, and
+ *                return whether it is. The page stays cached until
+ *                pagecache_unshare says the mapping is gone.
+ *
+ *    pagecache_unshare - undo pagecache_share, if PA is still that
+ *                page.
+ *
+ *    pagecache_truncate - zero whatever cached pages of V hold past
+ *                LEN, for when the file is truncated to LEN.
+ *
+ *    pagecache_purge - drop all the cached pages of V, as when the
+ *                file is deleted. Frames still in use stay with their
+ *                users; pages mapped shared stay cached. The caller
+ *                must hold a reference to V.
+ *
+ *    pagecache_flush - likewise for every file on FS, before FS is
+ *                unmounted.
+ *
+ *    pagecache_reclaim - free up to N frames by evicting pages nobody
+ *                has mapped from the cold end of the LRU list, looking
+ *                at no more than a few times N entries. If they are
+ *                all mapped, drops the coldest N not mapped shared
+ *                from the cache so the page replacement can have them.
+ *                Returns the number of frames freed.
+ *
+ *    pagecache_reap - let go of the vnodes of pages evicted by
+ *                pagecache_reclaim. That may mean reclaiming the
+ *                vnode, which can sleep and do I/O, so reclaim (which
+ *                runs in the middle of page replacement, holding a
+ *                spinlock) leaves it to be done later. Called from
+ *                file system entry points.
+ */
+
+#include <vm.h>
+
+struct vnode;
+struct fs;
+
+paddr_t pagecache_get(struct vnode *v, off_t offset);
+bool pagecache_add(struct vnode *v, off_t offset, paddr_t *pa);
+void pagecache_release(paddr_t pa);
+void pagecache_release_busy(paddr_t pa);
+bool pagecache_share(struct vnode *v, off_t offset, paddr_t pa);
+void pagecache_unshare(struct vnode *v, off_t offset, paddr_t pa);
+void pagecache_truncate(struct vnode *v, off_t len);
+void pagecache_purge(struct vnode *v);
+void pagecache_flush(struct fs *fs);
+unsigned pagecache_reclaim(unsigned n);
+void pagecache_reap(void);
+
+#endif /* _PAGECACHE_H_ */
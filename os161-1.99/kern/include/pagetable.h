@@ -0,0 +1,65 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for user address spaces.
+ *
+ * The top 10 bits of a virtual address pick an entry in the page
+ * directory, which points to a page of 1024 page table entries; the
+ * next 10 bits pick the PTE. Second-level tables are only allocated
+ * when something in their 4M of address space is touched.
+ *
+ * A PTE holds a physical frame number in its upper 20 bits and flags
+ * in the lower 12. A page that has been swapped out instead has its
+ * swap slot number in the upper 20 bits and PTE_SWAPPED set. A PTE of
+ * 0 means the page has never been touched.
+ *
+ * Functions:
+ *
+ *    pt_create - make an empty page table. Returns NULL if out of
+ *                memory.
+ *
+ *    pt_destroy - free the table itself. Does not free the frames
+ *                the PTEs refer to; use pt_walk for that first.
+ *
+ *    pt_lookup - return a pointer to the PTE for VADDR. If there is
+ *                no second-level table for it yet, returns NULL, or
+ *                if CREATE is set, allocates one (and returns NULL
+ *                only if that fails).
+ *
+ *    pt_walk   - call FUNC on every nonzero PTE, in address order.
+ *                Stops and returns the first nonzero value FUNC
+ *                returns.
+ */
+
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+#define PTE_FRAME	0xfffff000	/* physical frame, if PTE_VALID */
+#define PTE_VALID	0x00000001	/* page is resident in PTE_FRAME */
+#define PTE_COW		0x00000002	/* frame is shared; copy before writing */
+#define PTE_SWAPPED	0x00000004	/* page is in swap slot PTE_SLOT */
+#define PTE_DIRTY	0x00000008	/* shared file page not written back */
+#define PTE_PCACHE	0x00000010	/* frame belongs to the page cache */
+#define PTE_ZERO	0x00000020	/* the shared zero frame; always COW */
+
+#define PTE_SLOT(pte)		((pte) >> 12)
+#define PTE_MKSWAPPED(slot)	(((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+#define PT_NENTRIES	1024		/* entries per level */
+#define PT_L1INDEX(va)	(((va) >> 22) & 0x3ff)
+#define PT_L2INDEX(va)	(((va) >> 12) & 0x3ff)
+
+struct pagetable {
+	pte_t *pt_dir[PT_NENTRIES];
+};
+
+typedef int (*pt_walkfunc)(vaddr_t vaddr, pte_t *pte, void *data);
+
+struct pagetable *pt_create(void);
+void pt_destroy(struct pagetable *pt);
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+int pt_walk(struct pagetable *pt, pt_walkfunc func, void *data);
+
+#endif /* _PAGETABLE_H_ */
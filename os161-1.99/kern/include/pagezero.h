@@ -0,0 +1,27 @@
+#ifndef _PAGEZERO_H_
+#define _PAGEZERO_H_
+
+/*
+ * Pool of pre-zeroed page frames.
+ *
+ * A kernel thread keeps a small pool of frames that have already been
+ * zeroed, so that zero-fill page faults don't have to clear a page
+ * themselves. It only fills the pool while there is plenty of free
+ * memory, and yields after each page so that it runs mostly when
+ * nothing else wants the cpu.
+ *
+ * Functions:
+ *
+ *    pagezero_bootstrap - start the zeroing thread.
+ *
+ *    pagezero_get - take a zeroed frame (with one reference, as from
+ *                coremap_alloc) out of the pool. Returns 0 if the
+ *                pool is empty.
+ */
+
+#include <vm.h>
+
+void pagezero_bootstrap(void);
+paddr_t pagezero_get(void);
+
+#endif /* _PAGEZERO_H_ */
@@ -39,11 +39,16 @@
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <types.h>
 #include <synch.h>
+#include <limits.h>
 
 struct addrspace;
 struct vnode;
+#if OPT_A3
+struct openfile;
+#endif
 #ifdef UW
 struct semaphore;
 #endif // UW
@@ -51,10 +56,12 @@ struct semaphore;
 #if OPT_A2
 
 //list of locks: each lock and cv is associated with a pid
+//the lock and cv are part of the node, so adding one allocates
+//nothing else
 struct locklist {
 	pid_t ppid;
-	struct lock *lock;
-	struct cv *cv;
+	struct lock lock;
+	struct cv cv;
 	struct locklist *next;
 };
 //list to associate every child proc to a parent proc
@@ -118,6 +125,10 @@ struct proc {
 #if OPT_A2
   	pid_t pid;
 	pid_t ppid;
+#endif
+#if OPT_A3
+	/* open files, by file handle; see file.h (0-2 are the console) */
+	struct openfile *p_files[OPEN_MAX];
 #endif
 	/* add more material here as needed */
 };
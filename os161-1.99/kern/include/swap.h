@@ -0,0 +1,44 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space.
+ *
+ * Pages are swapped to the raw disk lhd1 (through its device vnode,
+ * "lhd1raw:"), one page per slot. A bitmap keeps track of which slots
+ * are in use. A slot can be referred to by more than one page table
+ * after fork, so each slot also has a reference count.
+ *
+ * Functions:
+ *
+ *    swap_bootstrap - open the swap disk. If there isn't one, swapping
+ *                is disabled and swap_alloc always fails.
+ *
+ *    swap_alloc - allocate a slot, with one reference. Returns ENOSPC
+ *                if swap is full (or missing).
+ *
+ *    swap_incref, swap_decref - add or drop a reference to a slot.
+ *                The slot is freed when the last reference goes.
+ *
+ *    swap_read  - read the page in SLOT into the frame at PADDR.
+ *
+ *    swap_write - write NPAGES frames out, the Nth to SLOTS[N]. Runs
+ *                of consecutive slots go out in a single disk request.
+ *
+ *    vm_swapin  - (in vm/vm.c) read the page swapped out behind PTE
+ *                into a new frame, and point PTE at that. Call with
+ *                the address space's as_lock held.
+ */
+
+#include <vm.h>
+#include <pagetable.h>
+
+void swap_bootstrap(void);
+int swap_alloc(unsigned *slot);
+void swap_incref(unsigned slot);
+void swap_decref(unsigned slot);
+int swap_read(unsigned slot, paddr_t paddr);
+int swap_write(unsigned npages, const paddr_t *paddrs, const unsigned *slots);
+int vm_swapin(pte_t *pte);
+
+#endif /* _SWAP_H_ */
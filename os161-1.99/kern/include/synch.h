@@ -36,22 +36,30 @@
 
 
 #include <spinlock.h>
+#include <wchan.h>
 
 /*
  * Dijkstra-style semaphore.
  *
- * The name field is for easier debugging. A copy of the name is made
- * internally.
+ * The name field is for easier debugging. sem_create makes a copy of
+ * the name internally.
+ *
+ * sem_init and sem_cleanup do the same as sem_create and sem_destroy
+ * for a semaphore that is part of some other structure. They allocate
+ * nothing, so sem_init can't fail, and the name is not copied: it
+ * should be a string constant.
  */
 struct semaphore {
-        char *sem_name;
-	struct wchan *sem_wchan;
+        const char *sem_name;
+	struct wchan sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
+void sem_init(struct semaphore *, const char *name, int initial_count);
+void sem_cleanup(struct semaphore *);
 
 /*
  * Operations (both atomic):
@@ -69,18 +77,23 @@ void V(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * The name field is for easier debugging. lock_create makes a copy
+ * of the name internally.
+ *
+ * lock_init and lock_cleanup are for a lock that is part of some
+ * other structure, as with sem_init and sem_cleanup.
  */
 struct lock {
-        char *lk_name;
-		struct wchan *lk_wchan;
+        const char *lk_name;
+		struct wchan lk_wchan;
 		struct spinlock lk_spinlk;
 		volatile bool lk_status;
 		volatile struct thread *lk_mother;
 };
 
 struct lock *lock_create(const char *name);
+void lock_init(struct lock *, const char *name);
+void lock_cleanup(struct lock *);
 void lock_acquire(struct lock *);
 
 /*
@@ -109,18 +122,23 @@ void lock_destroy(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * The name field is for easier debugging. cv_create makes a copy of
+ * the name internally.
+ *
+ * cv_init and cv_cleanup are for a CV that is part of some other
+ * structure, as with sem_init and sem_cleanup.
  */
 
 struct cv {
-        char *cv_name;
-		struct wchan *cv_wchan;
+        const char *cv_name;
+		struct wchan cv_wchan;
         //cv only contains a name and a wchan
 };
 
 struct cv *cv_create(const char *name);
 void cv_destroy(struct cv *);
+void cv_init(struct cv *, const char *name);
+void cv_cleanup(struct cv *);
 
 /*
  * Operations:
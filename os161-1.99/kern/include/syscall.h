@@ -30,6 +30,7 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -72,4 +73,16 @@ int sys_execv(char * progname, char **args);
 int stackarray(char **args, char **argsstack, int numargs);
 #endif
 
+#if OPT_A3
+int sys_sbrk(intptr_t amount, int32_t *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+	     userptr_t stackargs, int32_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys___vmstats(userptr_t counts, unsigned ncounts, int32_t *retval);
+int sys_open(userptr_t upath, int flags, int *retval);
+int sys_close(int fdesc);
+int sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval);
+int sys_fsync(int fdesc);
+#endif
+
 #endif /* _SYSCALL_H_ */
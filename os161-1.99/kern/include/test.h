@@ -79,7 +79,10 @@ int printfile(int, char **);
 /* other tests */
 int malloctest(int, char **);
 int mallocstress(int, char **);
+int mallocscale(int, char **);
+int mallocfreebench(int, char **);
 int nettest(int, char **);
+int copybench(int, char **);
 
 /* Routine for running a user-level program. */
 #if OPT_A2
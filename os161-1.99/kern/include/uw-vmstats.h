@@ -9,12 +9,14 @@
 /* Virtual memory stats */
 /* Tracks stats on user programs */
 
-/* NOTE !!!!!! WARNING !!!!!
+/* The counters live in each cpu's struct cpu and are bumped there
+ * without locks; readers add them up over all cpus.
+ *
  * All of the functions (except vmstats_print) whose names begin with '_'
- * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * assume that interrupts are already off, so the caller can't be moved
+ * to another cpu halfway through.
  * All of the functions whose names do not begin
- * with '_' ensure atomicity locally (except vmstats_print).
+ * with '_' turn interrupts off themselves (except vmstats_print).
  *
  * Generally you will use the functions whose names
  * do not begin with '_'.
@@ -24,33 +26,26 @@
 /* These are the different stats that get tracked.
  * See vmstats.c for strings corresponding to each stat.
  */
-
-/* DO NOT ADD OR CHANGE WITHOUT ALSO CHANGING vmstats.h */
-#define VMSTAT_TLB_FAULT              (0)
-#define VMSTAT_TLB_FAULT_FREE         (1)
-#define VMSTAT_TLB_FAULT_REPLACE      (2)
-#define VMSTAT_TLB_INVALIDATE         (3)
-#define VMSTAT_TLB_RELOAD             (4)
-#define VMSTAT_PAGE_FAULT_ZERO        (5)
-#define VMSTAT_PAGE_FAULT_DISK        (6)
-#define VMSTAT_ELF_FILE_READ          (7)
-#define VMSTAT_SWAP_FILE_READ         (8)
-#define VMSTAT_SWAP_FILE_WRITE        (9)
-#define VMSTAT_COUNT                 (10)
+#include <kern/vmstats.h>
 
 /* ----------------------------------------------------------------------- */
 
 /* Initialize the statistics: must be called before using */
-void vmstats_init(void);                     /* uses locking */
-void _vmstats_init(void);                    /* atomicity must be ensured elsewhere */
+void vmstats_init(void);                     /* disables interrupts */
+void _vmstats_init(void);                    /* interrupts must be off */
 
 /* Increment the specified count 
  * Example use: 
  *   vmstats_inc(VMSTAT_TLB_FAULT);
  *   vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
  */
-void vmstats_inc(unsigned int index);    /* uses locking */
-void _vmstats_inc(unsigned int index);   /* atomicity must be ensured elsewhere */
+void vmstats_inc(unsigned int index);    /* disables interrupts */
+void _vmstats_inc(unsigned int index);   /* interrupts must be off */
+
+/* Add up the counters of all cpus into counts[VMSTAT_COUNT].
+ * Counts still being bumped elsewhere may or may not be included.
+ */
+void vmstats_snapshot(unsigned int *counts);
 
 /* Print the statistics: assumes that at least vmstats_init has been called */
 void vmstats_print(void);                    /* Does NOT use locking */
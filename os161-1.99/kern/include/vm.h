@@ -55,6 +55,20 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 vaddr_t alloc_kpages(int npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Fault-around: on a TLB miss, also load up to this many following
+ * resident pages of the region. Each region starts with a window of
+ * VM_FAULTAROUND_INIT pages and grows or shrinks it according to how
+ * many of its preloaded entries get used. 0 turns preloading off.
+ */
+#define VM_FAULTAROUND_INIT  2
+#define VM_FAULTAROUND_MAX   16
+void vm_set_faultaround(unsigned npages);
+unsigned vm_get_faultaround(void);
+
+/* Empty this cpu's software TLB; call with interrupts off */
+void vm_stlb_flush(void);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
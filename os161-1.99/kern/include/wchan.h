@@ -32,10 +32,20 @@
 
 /*
  * Wait channel.
+ *
+ * The structure is visible so that wait channels can be embedded in
+ * other structures (as in the synchronization primitives); its fields
+ * are private to thread.c.
  */
 
+#include <spinlock.h>
+#include <threadlist.h>
 
-struct wchan; /* Opaque */
+struct wchan {
+	const char *wc_name;		/* name for this channel */
+	struct threadlist wc_threads;	/* list of waiting threads */
+	struct spinlock wc_lock;	/* lock for mutual exclusion */
+};
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -49,6 +59,13 @@ struct wchan *wchan_create(const char *name);
  */
 void wchan_destroy(struct wchan *wc);
 
+/*
+ * Initialize and clean up a wait channel embedded in something else,
+ * rather than allocated by wchan_create. The same rules apply.
+ */
+void wchan_init(struct wchan *wc, const char *name);
+void wchan_cleanup(struct wchan *wc);
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
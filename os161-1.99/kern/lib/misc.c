@@ -39,7 +39,7 @@ kstrdup(const char *s)
 {
 	char *z;
 
-	z = kmalloc(strlen(s)+1);
+	z = kmalloc_at(strlen(s)+1, (vaddr_t)__builtin_return_address(0));
 	if (z == NULL) {
 		return NULL;
         }
@@ -51,13 +51,28 @@
 #include <synch.h>
 #include <kern/fcntl.h>  
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <limits.h>
 #include <kern/errno.h>
+#include <kmemcache.h>
+#if OPT_A3
+#include <file.h>
+#endif
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/*
+ * Cache of proc structures. They are kept with p_lock and p_threads
+ * (and whatever space p_threads has grown) set up.
+ */
+static int proc_ctor(void *obj);
+static void proc_dtor(void *obj);
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+			       proc_ctor, proc_dtor, KC_MAXFREE);
+
 
 /*
  * Mechanism for making the kernel menu thread sleep while processes are running
@@ -136,8 +151,8 @@ void addlock(pid_t ppid) {
 	node = kmalloc(sizeof(struct locklist ));
 	if(node == NULL) panic("\nnot enough mem!!!\n");
 	node->ppid = ppid;
-	node->lock = lock_create("locklist");
-	node->cv = cv_create("locklist");
+	lock_init(&node->lock, "locklist");
+	cv_init(&node->cv, "locklist");
 	node->next = NULL;
 	if(listoflocks == NULL) {
 		listoflocks = node;
@@ -166,8 +181,8 @@ void removelock(pid_t pid) {
 		}
 		prev->next = node->next;
 	}
-	lock_destroy(node->lock);
-	cv_destroy(node->cv);
+	lock_cleanup(&node->lock);
+	cv_cleanup(&node->cv);
 	kfree(node);
 }
 //retrieves a lock associated with given pid
@@ -178,7 +193,7 @@ struct lock *lockretrieve(pid_t ppid) {
 	while(node->ppid != ppid) {
 		node = node->next;
 	}
-	return node->lock;
+	return &node->lock;
 }
 
 //retrieves a cv associated with given pid
@@ -188,7 +203,7 @@ struct cv *cvretrieve(pid_t ppid) {
 	while(node->ppid != ppid) {
 		node = node->next;
 	}
-	return node->cv;
+	return &node->cv;
 }
 
 //checks if the given process' pid is curproc's child
@@ -363,6 +378,27 @@ void addexitcode(pid_t pid, int exitcode) {
 #endif
 
 
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+}
+
 /*
  * Create a proc structure.
  */
@@ -371,20 +407,20 @@ struct proc *
 proc_create(const char *name)
 {
 	struct proc *proc;
+#if OPT_A3
+	int fd;
+#endif
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
-
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
@@ -398,6 +434,11 @@ proc_create(const char *name)
 	proc->ppid = 0;
 	proc->pid = pidcreator();
 #endif
+#if OPT_A3
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		proc->p_files[fd] = NULL;
+	}
+#endif
 
 	return proc;
 }
@@ -457,12 +498,15 @@ proc_destroy(struct proc *proc)
 	  vfs_close(proc->console);
 	}
 #endif // UW
+#if OPT_A3
+	filetable_closeall(proc);
+#endif
 
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
+	/* p_threads and p_lock go back to the cache as they are */
+	KASSERT(threadarray_num(&proc->p_threads) == 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
@@ -50,6 +50,10 @@
 #include <test.h>
 #include <version.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-A3.h"
+#if OPT_A3
+#include <uw-vmstats.h>
+#endif
 
 /*
  * These two pieces of data are maintained by the makefiles and build system.
@@ -151,6 +155,10 @@ shutdown(void)
 
 	thread_shutdown();
 
+#if OPT_A3
+	vmstats_print();
+#endif
+
 	splhigh();
 }
 
@@ -42,10 +42,18 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmemcache.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
+#include "opt-kmallocprof.h"
+#if OPT_A3
+#include <coremap.h>
+#include <vm.h>
+#include <addrspace.h>
+#endif
 
 /*
  * In-kernel menu and command dispatcher.
@@ -408,6 +416,96 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+#if OPT_KMALLOCPROF
+/*
+ * Command for printing the top kmalloc call sites.
+ */
+static
+int
+cmd_kprofile(int nargs, char **args)
+{
+	unsigned n = 10;
+
+	if (nargs > 2) {
+		kprintf("Usage: %s [count]\n", args[0]);
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+	}
+
+	kheap_printsites(n, !strcmp(args[0], "kph"));
+
+	return 0;
+}
+#endif
+
+static
+int
+cmd_kcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+#if OPT_A3
+static
+int
+cmd_coremapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	coremap_printstats();
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting the fault-around window.
+ */
+static
+int
+cmd_faultaround(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: fa [npages]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		vm_set_faultaround(atoi(args[1]));
+	}
+	kprintf("Fault-around window: at most %u pages\n",
+		vm_get_faultaround());
+
+	return 0;
+}
+
+/*
+ * Command for showing or setting the stack size limit of new
+ * processes.
+ */
+static
+int
+cmd_stacklimit(int nargs, char **args)
+{
+	if (nargs > 2) {
+		kprintf("Usage: sl [kbytes]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		as_set_stacklimit(atoi(args[1]) * 1024);
+	}
+	kprintf("Stack size limit: %uK\n", as_get_stacklimit() / 1024);
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -469,6 +567,9 @@ static const char *testmenu[] = {
 	"[bt]  Bitmap test                   ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
+	"[km3] kmalloc scaling test          ",
+	"[km4] kfree benchmark               ",
+	"[cpb] copyin/copyout benchmark      ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -517,6 +618,16 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[kc] Kernel object cache stats      ",
+#if OPT_KMALLOCPROF
+	"[kp] kmalloc sites by live bytes    ",
+	"[kph] kmalloc sites by high-water   ",
+#endif
+#if OPT_A3
+	"[cm] Coremap free block stats       ",
+	"[fa] Fault-around window            ",
+	"[sl] Stack size limit               ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -573,12 +684,25 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "kc",         cmd_kcachestats },
+#if OPT_KMALLOCPROF
+	{ "kp",         cmd_kprofile },
+	{ "kph",        cmd_kprofile },
+#endif
+#if OPT_A3
+	{ "cm",         cmd_coremapstats },
+	{ "fa",         cmd_faultaround },
+	{ "sl",         cmd_stacklimit },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
+	{ "km3",	mallocscale },
+	{ "km4",	mallocfreebench },
+	{ "cpb",	copybench },
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -0,0 +1,150 @@
+/*
+ * Open files and per-process file tables. See file.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <proc.h>
+#include <file.h>
+
+int
+file_open(char *path, int flags, struct openfile **ret)
+{
+	struct openfile *of;
+	struct vnode *v;
+	int result;
+
+	of = kmalloc(sizeof(struct openfile));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+
+	result = vfs_open(path, flags, 0, &v);
+	if (result) {
+		kfree(of);
+		return result;
+	}
+
+	of->of_vnode = v;
+	of->of_accmode = flags & O_ACCMODE;
+	of->of_append = (flags & O_APPEND) != 0;
+	lock_init(&of->of_lock, "openfile");
+	of->of_offset = 0;
+	spinlock_init(&of->of_countlock);
+	of->of_refcount = 1;
+
+	*ret = of;
+	return 0;
+}
+
+void
+file_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_countlock);
+	of->of_refcount++;
+	spinlock_release(&of->of_countlock);
+}
+
+void
+file_decref(struct openfile *of)
+{
+	bool last;
+
+	spinlock_acquire(&of->of_countlock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = of->of_refcount == 0;
+	spinlock_release(&of->of_countlock);
+
+	if (!last) {
+		return;
+	}
+	vfs_close(of->of_vnode);
+	spinlock_cleanup(&of->of_countlock);
+	lock_cleanup(&of->of_lock);
+	kfree(of);
+}
+
+int
+filetable_add(struct proc *proc, struct openfile *of, int *fd)
+{
+	int i;
+
+	spinlock_acquire(&proc->p_lock);
+	for (i = FILE_FIRSTFD; i < OPEN_MAX; i++) {
+		if (proc->p_files[i] == NULL) {
+			proc->p_files[i] = of;
+			spinlock_release(&proc->p_lock);
+			*fd = i;
+			return 0;
+		}
+	}
+	spinlock_release(&proc->p_lock);
+	return EMFILE;
+}
+
+struct openfile *
+filetable_get(struct proc *proc, int fd)
+{
+	struct openfile *of;
+
+	if (fd < FILE_FIRSTFD || fd >= OPEN_MAX) {
+		return NULL;
+	}
+	spinlock_acquire(&proc->p_lock);
+	of = proc->p_files[fd];
+	spinlock_release(&proc->p_lock);
+	return of;
+}
+
+struct openfile *
+filetable_remove(struct proc *proc, int fd)
+{
+	struct openfile *of;
+
+	if (fd < FILE_FIRSTFD || fd >= OPEN_MAX) {
+		return NULL;
+	}
+	spinlock_acquire(&proc->p_lock);
+	of = proc->p_files[fd];
+	proc->p_files[fd] = NULL;
+	spinlock_release(&proc->p_lock);
+	return of;
+}
+
+void
+filetable_copy(struct proc *oldproc, struct proc *newproc)
+{
+	struct openfile *of;
+	int i;
+
+	for (i = FILE_FIRSTFD; i < OPEN_MAX; i++) {
+		spinlock_acquire(&oldproc->p_lock);
+		of = oldproc->p_files[i];
+		if (of != NULL) {
+			file_incref(of);
+		}
+		spinlock_release(&oldproc->p_lock);
+		newproc->p_files[i] = of;
+	}
+}
+
+void
+filetable_closeall(struct proc *proc)
+{
+	struct openfile *of;
+	int i;
+
+	for (i = FILE_FIRSTFD; i < OPEN_MAX; i++) {
+		of = filetable_remove(proc, i);
+		if (of != NULL) {
+			file_decref(of);
+		}
+	}
+}
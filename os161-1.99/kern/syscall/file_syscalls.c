@@ -8,6 +8,153 @@
 #include <vfs.h>
 #include <current.h>
 #include <proc.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <kern/fcntl.h>
+#include <limits.h>
+#include <stat.h>
+#include <synch.h>
+#include <copyinout.h>
+#include <addrspace.h>
+#include <file.h>
+#endif
+
+#if OPT_A3
+/*
+ * Read or write NBYTES at UBUF through open file FDESC, at its seek
+ * position (or, for an O_APPEND write, at the end), which moves past
+ * whatever was transferred.
+ */
+static
+int
+file_rw(int fdesc, userptr_t ubuf, unsigned int nbytes, enum uio_rw rw,
+	int *retval)
+{
+	struct openfile *of;
+	struct iovec iov;
+	struct uio u;
+	struct stat st;
+	int res;
+
+	of = filetable_get(curproc, fdesc);
+	if (of == NULL) {
+		return EBADF;
+	}
+	if ((rw == UIO_READ && of->of_accmode == O_WRONLY) ||
+	    (rw == UIO_WRITE && of->of_accmode == O_RDONLY)) {
+		return EBADF;
+	}
+
+	lock_acquire(&of->of_lock);
+	if (rw == UIO_WRITE && of->of_append) {
+		res = VOP_STAT(of->of_vnode, &st);
+		if (res) {
+			lock_release(&of->of_lock);
+			return res;
+		}
+		of->of_offset = st.st_size;
+	}
+
+	iov.iov_ubase = ubuf;
+	iov.iov_len = nbytes;
+	u.uio_iov = &iov;
+	u.uio_iovcnt = 1;
+	u.uio_offset = of->of_offset;
+	u.uio_resid = nbytes;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = curproc_getas();
+
+	res = rw == UIO_READ ? VOP_READ(of->of_vnode, &u) :
+		VOP_WRITE(of->of_vnode, &u);
+	if (res == 0) {
+		of->of_offset = u.uio_offset;
+		*retval = nbytes - u.uio_resid;
+	}
+	lock_release(&of->of_lock);
+	return res;
+}
+
+/*
+ * open: only files; the console is already open on handles 0-2.
+ */
+int
+sys_open(userptr_t upath, int flags, int *retval)
+{
+	struct openfile *of;
+	char *path;
+	int result;
+
+	switch (flags & O_ACCMODE) {
+	    case O_RDONLY:
+	    case O_WRONLY:
+	    case O_RDWR:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(upath, path, PATH_MAX, NULL);
+	if (result == 0) {
+		/* vfs_open trashes the path */
+		result = file_open(path, flags, &of);
+	}
+	kfree(path);
+	if (result) {
+		return result;
+	}
+
+	result = filetable_add(curproc, of, retval);
+	if (result) {
+		file_decref(of);
+	}
+	return result;
+}
+
+int
+sys_close(int fdesc)
+{
+	struct openfile *of;
+
+	of = filetable_remove(curproc, fdesc);
+	if (of == NULL) {
+		return EBADF;
+	}
+	file_decref(of);
+	return 0;
+}
+
+int
+sys_read(int fdesc, userptr_t ubuf, unsigned int nbytes, int *retval)
+{
+	return file_rw(fdesc, ubuf, nbytes, UIO_READ, retval);
+}
+
+/*
+ * fsync: write back what the process has written through shared
+ * mappings of the file first, since there is no msync.
+ */
+int
+sys_fsync(int fdesc)
+{
+	struct openfile *of;
+	int result;
+
+	of = filetable_get(curproc, fdesc);
+	if (of == NULL) {
+		return EBADF;
+	}
+	result = as_sync(curproc_getas(), of->of_vnode);
+	if (result) {
+		return result;
+	}
+	return VOP_FSYNC(of->of_vnode);
+}
+#endif /* OPT_A3 */
 
 /* handler for write() system call                  */
 /*
@@ -17,6 +164,9 @@
  * Also, it does not provide any synchronization, so writes
  * are not atomic.
  *
+ * (With OPT_A3, writes to files opened with open() go through
+ * file_rw instead.)
+ *
  * You will need to improve this implementation
  */
 
@@ -29,6 +179,11 @@ sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
 
   DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
   
+#if OPT_A3
+  if (fdesc >= FILE_FIRSTFD) {
+    return file_rw(fdesc, ubuf, nbytes, UIO_WRITE, retval);
+  }
+#endif
   /* only stdout and stderr writes are currently implemented */
   if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
     return EUNIMP;
@@ -10,6 +10,7 @@
 #include <addrspace.h>
 #include <copyinout.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 #include <synch.h>
 #include <spl.h>
 #include <mips/trapframe.h> 
@@ -17,6 +18,9 @@
 #include <kern/fcntl.h>
 #include <kern/limits.h>
 #include <limits.h>
+#if OPT_A3
+#include <file.h>
+#endif
 
 #if OPT_A2
 
@@ -106,6 +110,7 @@ int sys_execv(char *progname, char **args) {
 	//copy the individual strings in args into the real stack
 	if(args != NULL) {
 		vaddr_t argsptr[numargs+1];
+		struct copyvec argsvec[numargs+1];
 		y = numargs - 1;
 
 		//the given stackptr starts at the top
@@ -118,9 +123,10 @@ int sys_execv(char *progname, char **args) {
 			//shift stackptr to start of stack location where arg can be copied
 			stackptr = stackptr - argsstrlen - argsstrspace;
 
-			//and copy stack array into real stack
-			result = copyoutstr(argsstack[y], (userptr_t)stackptr, argsstrlen, NULL);
-			if(result) return result;
+			//and queue the string to be copied there
+			argsvec[y].cv_kaddr = argsstack[y];
+			argsvec[y].cv_uaddr = (userptr_t)stackptr;
+			argsvec[y].cv_len = argsstrlen;
 
 			//point to the current location in stack
 			argsptr[y] = stackptr;
@@ -128,16 +134,16 @@ int sys_execv(char *progname, char **args) {
 		}
 		//the top of the stack will be pointing to nothing
 		argsptr[numargs] = 0;
-		y = numargs;
 
-		//bottom part of stack is list of pointers
-		while(y >= 0) {
-		//so decrement by its size and copy the pointers onto stack
-			stackptr = stackptr - sizeof(vaddr_t);
-			result = copyout(&argsptr[y], (userptr_t)stackptr, sizeof(vaddr_t));
-			if(result) return result;
-			y--;
-		}
+		//bottom part of stack is list of pointers, in one piece
+		stackptr = stackptr - (numargs + 1) * sizeof(vaddr_t);
+		argsvec[numargs].cv_kaddr = argsptr;
+		argsvec[numargs].cv_uaddr = (userptr_t)stackptr;
+		argsvec[numargs].cv_len = (numargs + 1) * sizeof(vaddr_t);
+
+		//copy the strings and the pointers onto the stack in one go
+		result = copyoutv(argsvec, numargs + 1);
+		if(result) return result;
 	}
 
 	/* Warp to user mode. */
@@ -154,19 +160,26 @@ int sys_fork(struct trapframe *tf, int32_t * retval) {
 	struct addrspace *newspace;
 
 	int x;
+
+	//copy the address space first: it may sleep waiting for swap,
+	//which can't happen with interrupts off
+	x = as_copy(curproc->p_addrspace, &newspace);
+	if(x) {
+		return x;
+	}
+
 	int plvl = splhigh();
 	newproc = proc_create_runprogram("child");
 
 	//error checking
 	if(newproc == NULL) {
+		splx(plvl);
+		as_destroy(newspace);
 		return ENOMEM;
 	}
 	if(validpid(newproc->pid) == 0) {
-		return ENOMEM;
-	}
-
-	x = as_copy(curproc->p_addrspace, &newspace);
-	if(x == ENOMEM) {
+		splx(plvl);
+		as_destroy(newspace);
 		return ENOMEM;
 	}
 
@@ -177,6 +190,10 @@ int sys_fork(struct trapframe *tf, int32_t * retval) {
 	}
 	//sets the parent pid of the new proc to be the current proc
 	newproc->ppid = curproc->pid;
+#if OPT_A3
+	//the child shares the parent's open files
+	filetable_copy(curproc, newproc);
+#endif
 
 	//initializing new node for the procstats list of information:
 	//modify procstats to set the newproc's run status as "running": 1
@@ -0,0 +1,149 @@
+/*
+ * Memory management system calls for the paged VM system.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <stat.h>
+#include <vnode.h>
+#include <file.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <uw-vmstats.h>
+
+/*
+ * sbrk: move the heap break by AMOUNT bytes and return the old break.
+ */
+int
+sys_sbrk(intptr_t amount, int32_t *retval)
+{
+	struct addrspace *as;
+	vaddr_t oldbreak;
+	int result;
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	result = as_sbrk(as, amount, &oldbreak);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)oldbreak;
+	return 0;
+}
+
+/*
+ * mmap. ADDR is only a hint, and is ignored. The file handle and the
+ * offset don't fit in registers, and are on the user stack at
+ * STACKARGS (the offset, being 64 bits, 8 bytes in). Files can be
+ * mapped if they are regular files, at a page-aligned offset, and open
+ * for whatever access the mapping allows; writing through a shared
+ * mapping needs write access to the file, a private one doesn't.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags,
+	 userptr_t stackargs, int32_t *retval)
+{
+	struct addrspace *as;
+	struct openfile *of;
+	struct vnode *v;
+	vaddr_t base;
+	mode_t type;
+	off_t offset;
+	int fd, result;
+
+	(void)addr;
+
+	result = copyin(stackargs, &fd, sizeof(fd));
+	if (result) {
+		return result;
+	}
+
+	if (flags & MAP_ANON) {
+		if (fd != -1) {
+			return EINVAL;
+		}
+		v = NULL;
+		offset = 0;
+	}
+	else {
+		of = filetable_get(curproc, fd);
+		if (of == NULL) {
+			return EBADF;
+		}
+		result = copyin((userptr_t)((vaddr_t)stackargs + 8), &offset,
+				sizeof(offset));
+		if (result) {
+			return result;
+		}
+		if (offset < 0 || offset % PAGE_SIZE != 0) {
+			return EINVAL;
+		}
+		if (of->of_accmode == O_WRONLY ||
+		    ((flags & MAP_SHARED) && (prot & PROT_WRITE) &&
+		     of->of_accmode != O_RDWR)) {
+			return EACCES;
+		}
+		v = of->of_vnode;
+		result = VOP_GETTYPE(v, &type);
+		if (result) {
+			return result;
+		}
+		if (type != S_IFREG) {
+			return ENODEV;
+		}
+	}
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	result = as_mmap(as, len, prot, flags, v, offset, &base);
+	if (result) {
+		return result;
+	}
+	*retval = (int32_t)base;
+	return 0;
+}
+
+/*
+ * munmap: only whole mappings can be unmapped.
+ */
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+	struct addrspace *as;
+
+	as = curproc_getas();
+	KASSERT(as != NULL);
+
+	return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/*
+ * __vmstats: copy out up to NCOUNTS of the VM statistics counters
+ * (see <kern/vmstats.h>) and return how many there are.
+ */
+int
+sys___vmstats(userptr_t counts, unsigned ncounts, int32_t *retval)
+{
+	unsigned int snap[VMSTAT_COUNT];
+	int result;
+
+	if (ncounts > VMSTAT_COUNT) {
+		ncounts = VMSTAT_COUNT;
+	}
+
+	vmstats_snapshot(snap);
+	result = copyout(snap, counts, ncounts * sizeof(snap[0]));
+	if (result) {
+		return result;
+	}
+	*retval = VMSTAT_COUNT;
+	return 0;
+}
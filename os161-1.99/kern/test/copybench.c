@@ -0,0 +1,369 @@
+/*
+ * Benchmark for copyin/copyout/copyinstr and the batch versions,
+ * against the way they used to do it: memcpy, one byte at a time
+ * unless everything is word-aligned, and a byte-by-byte string copy,
+ * each with its own setjmp.
+ *
+ * Runs in the menu thread, with a scratch address space of a few
+ * pages installed for the duration.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <setjmp.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <test.h>
+
+#define CB_BASE		0x10000000	/* user address of scratch region */
+#define CB_PAGES	4
+#define CB_LOOPS	2000
+#define CB_NVEC		16		/* buffers per batch */
+#define CB_VECLEN	8		/* bytes per buffer in a batch */
+#define CB_STRLEN	255
+
+static char cb_kbuf[PAGE_SIZE + 8];
+
+////////////////////////////////////////////////////////////
+//
+// The old versions
+
+static
+void
+oldcopyfail(void)
+{
+	longjmp(curthread->t_machdep.tm_copyjmp, 1);
+}
+
+static
+int
+oldcopyin(const_userptr_t usersrc, void *dest, size_t len)
+{
+	curthread->t_machdep.tm_badfaultfunc = oldcopyfail;
+	if (setjmp(curthread->t_machdep.tm_copyjmp)) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+	memcpy(dest, (const void *)usersrc, len);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+static
+int
+oldcopyout(const void *src, userptr_t userdest, size_t len)
+{
+	curthread->t_machdep.tm_badfaultfunc = oldcopyfail;
+	if (setjmp(curthread->t_machdep.tm_copyjmp)) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+	memcpy((void *)userdest, src, len);
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+static
+int
+oldcopyinstr(const_userptr_t usersrc, char *dest, size_t len,
+	     size_t *actual)
+{
+	const char *src = (const char *)usersrc;
+	size_t i;
+
+	curthread->t_machdep.tm_badfaultfunc = oldcopyfail;
+	if (setjmp(curthread->t_machdep.tm_copyjmp)) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+	for (i=0; i<len; i++) {
+		dest[i] = src[i];
+		if (src[i] == 0) {
+			*actual = i+1;
+			curthread->t_machdep.tm_badfaultfunc = NULL;
+			return 0;
+		}
+	}
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return ENAMETOOLONG;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Timing
+
+static time_t cb_secs;
+static uint32_t cb_nsecs;
+
+static
+void
+cb_start(void)
+{
+	gettime(&cb_secs, &cb_nsecs);
+}
+
+static
+void
+cb_stop(const char *what, int result)
+{
+	time_t secs;
+	uint32_t nsecs;
+	unsigned long usecs;
+
+	gettime(&secs, &nsecs);
+	getinterval(cb_secs, cb_nsecs, secs, nsecs, &secs, &nsecs);
+	usecs = secs * 1000000 + nsecs / 1000;
+
+	if (result) {
+		kprintf("  %-34s failed: %s\n", what, strerror(result));
+		return;
+	}
+	kprintf("  %-34s %8lu us  %6lu ns/op\n", what, usecs,
+		(unsigned long)(usecs * 1000 / CB_LOOPS));
+}
+
+////////////////////////////////////////////////////////////
+//
+// The tests
+
+static
+void
+cb_block(userptr_t ubuf, size_t kskew, size_t uskew, size_t len)
+{
+	char what[40];
+	char *kbuf = cb_kbuf + kskew;
+	userptr_t u = (userptr_t)((vaddr_t)ubuf + uskew);
+	int i, result;
+
+	snprintf(what, sizeof(what), "copyin %u bytes, skew %u/%u, old",
+		 len, kskew, uskew);
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = oldcopyin(u, kbuf, len);
+	}
+	cb_stop(what, result);
+
+	snprintf(what, sizeof(what), "copyin %u bytes, skew %u/%u, new",
+		 len, kskew, uskew);
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = copyin(u, kbuf, len);
+	}
+	cb_stop(what, result);
+
+	snprintf(what, sizeof(what), "copyout %u bytes, skew %u/%u, old",
+		 len, kskew, uskew);
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = oldcopyout(kbuf, u, len);
+	}
+	cb_stop(what, result);
+
+	snprintf(what, sizeof(what), "copyout %u bytes, skew %u/%u, new",
+		 len, kskew, uskew);
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = copyout(kbuf, u, len);
+	}
+	cb_stop(what, result);
+}
+
+static
+void
+cb_batch(userptr_t ubuf)
+{
+	struct copyvec vec[CB_NVEC];
+	int i, j, result;
+
+	for (j=0; j<CB_NVEC; j++) {
+		vec[j].cv_kaddr = cb_kbuf + j * CB_VECLEN;
+		vec[j].cv_uaddr = (userptr_t)((vaddr_t)ubuf + j * 2*CB_VECLEN);
+		vec[j].cv_len = CB_VECLEN;
+	}
+
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		for (j=0; j<CB_NVEC && !result; j++) {
+			result = oldcopyout(vec[j].cv_kaddr, vec[j].cv_uaddr,
+					    vec[j].cv_len);
+		}
+	}
+	cb_stop("copyout 16 x 8 bytes, old", result);
+
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		for (j=0; j<CB_NVEC && !result; j++) {
+			result = copyout(vec[j].cv_kaddr, vec[j].cv_uaddr,
+					 vec[j].cv_len);
+		}
+	}
+	cb_stop("copyout 16 x 8 bytes, new", result);
+
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = copyoutv(vec, CB_NVEC);
+	}
+	cb_stop("copyoutv 16 x 8 bytes", result);
+}
+
+static
+void
+cb_string(userptr_t ubuf)
+{
+	char str[CB_STRLEN + 1];
+	size_t got;
+	int i, result;
+
+	for (i=0; i<CB_STRLEN; i++) {
+		str[i] = 'a' + i % 26;
+	}
+	str[CB_STRLEN] = 0;
+	result = copyout(str, ubuf, sizeof(str));
+	if (result) {
+		kprintf("copybench: copyout: %s\n", strerror(result));
+		return;
+	}
+
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = oldcopyinstr(ubuf, cb_kbuf, PAGE_SIZE, &got);
+	}
+	cb_stop("copyinstr 255 chars, old", result);
+
+	cb_start();
+	for (i=0, result=0; i<CB_LOOPS && !result; i++) {
+		result = copyinstr(ubuf, cb_kbuf, PAGE_SIZE, &got);
+	}
+	cb_stop("copyinstr 255 chars, new", result);
+
+	if (result == 0 && (got != sizeof(str) || strcmp(cb_kbuf, str))) {
+		kprintf("copybench: copyinstr got the wrong string\n");
+	}
+}
+
+/*
+ * Check that the new paths copy the right bytes for every alignment
+ * and a spread of lengths, and that copyinstr stops where it should.
+ */
+static
+int
+cb_verify(userptr_t ubuf)
+{
+	char pattern[64 + 8];
+	size_t len, ks, us, i;
+	int result;
+
+	for (i=0; i<sizeof(pattern); i++) {
+		pattern[i] = i * 7 + 1;
+	}
+	for (ks=0; ks<4; ks++) {
+		for (us=0; us<4; us++) {
+			for (len=0; len<=64; len++) {
+				userptr_t u = (userptr_t)((vaddr_t)ubuf + us);
+
+				result = copyout(pattern + ks, u, len);
+				if (result) {
+					return result;
+				}
+				bzero(cb_kbuf, len + 8);
+				result = copyin(u, cb_kbuf + ks, len);
+				if (result) {
+					return result;
+				}
+				for (i=0; i<len; i++) {
+					if (cb_kbuf[ks + i] != pattern[ks + i]) {
+						break;
+					}
+				}
+				if (i < len || cb_kbuf[ks + len] != 0) {
+					kprintf("copybench: wrong data: "
+						"%u bytes, skew %u/%u\n",
+						len, ks, us);
+					return EINVAL;
+				}
+			}
+		}
+	}
+
+	for (ks=0; ks<4; ks++) {
+		for (us=0; us<4; us++) {
+			userptr_t u = (userptr_t)((vaddr_t)ubuf + us);
+			const char *str = "copyinstr, a word at a time";
+			size_t got;
+
+			result = copyout(str, u, strlen(str) + 1);
+			if (result) {
+				return result;
+			}
+			result = copyinstr(u, cb_kbuf + ks, 64, &got);
+			if (result) {
+				return result;
+			}
+			if (got != strlen(str) + 1 || strcmp(cb_kbuf + ks, str)) {
+				kprintf("copybench: wrong string: skew %u/%u\n",
+					ks, us);
+				return EINVAL;
+			}
+			result = copyinstr(u, cb_kbuf + ks, 8, &got);
+			if (result != ENAMETOOLONG) {
+				kprintf("copybench: copyinstr didn't stop "
+					"at its length: skew %u/%u\n", ks, us);
+				return EINVAL;
+			}
+		}
+	}
+	return 0;
+}
+
+int
+copybench(int nargs, char **args)
+{
+	struct addrspace *as, *oldas;
+	userptr_t ubuf = (userptr_t)CB_BASE;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	as = as_create();
+	if (as == NULL) {
+		return ENOMEM;
+	}
+	result = as_define_region(as, CB_BASE, CB_PAGES * PAGE_SIZE, 1, 1, 0);
+	if (result == 0) {
+		result = as_prepare_load(as);
+	}
+	if (result == 0) {
+		result = as_complete_load(as);
+	}
+	if (result) {
+		as_destroy(as);
+		return result;
+	}
+	oldas = curproc_setas(as);
+	as_activate();
+
+	result = cb_verify(ubuf);
+	if (result == 0) {
+		kprintf("copybench: %d loops each\n", CB_LOOPS);
+		cb_block(ubuf, 0, 0, PAGE_SIZE);
+		cb_block(ubuf, 1, 1, 1000);
+		cb_block(ubuf, 0, 0, 4);
+		cb_batch(ubuf);
+		cb_string(ubuf);
+	}
+
+	curproc_setas(oldas);
+	as_activate();
+	as_destroy(as);
+
+	if (result == 0) {
+		kprintf("copybench done.\n");
+	}
+	return result;
+}
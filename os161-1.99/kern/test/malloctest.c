@@ -31,7 +31,10 @@
  * Test code for kmalloc.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <clock.h>
+#include <cpu.h>
 #include <thread.h>
 #include <synch.h>
 #include <test.h>
@@ -137,3 +140,183 @@ mallocstress(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * kmalloc scaling test: NTRIES3 kmalloc/kfree pairs of assorted
+ * sizes in each of 1 thread, then 2, and so on up to one per cpu, all at
+ * once. Prints the allocation rate for each number of threads; with
+ * the per-cpu magazines it should grow with the number of cpus. (The
+ * scheduler spreads the threads over the cpus as they go idle.)
+ */
+
+#define NTRIES3   20000
+#define NLIVE3    8
+
+static const size_t mallocscale_sizes[] = { 24, 48, 100, 200, 400, 1000 };
+#define NSIZES3 (sizeof(mallocscale_sizes) / sizeof(mallocscale_sizes[0]))
+
+static
+void
+mallocscalethread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	void *ptrs[NLIVE3];
+	unsigned i, j;
+
+	for (j=0; j<NLIVE3; j++) {
+		ptrs[j] = NULL;
+	}
+
+	for (i=0; i<NTRIES3; i++) {
+		j = i % NLIVE3;
+		kfree(ptrs[j]);
+		ptrs[j] = kmalloc(mallocscale_sizes[(i + num) % NSIZES3]);
+		if (ptrs[j] == NULL) {
+			kprintf("km3: thread %lu: kmalloc returned NULL\n",
+				num);
+			break;
+		}
+	}
+
+	for (j=0; j<NLIVE3; j++) {
+		kfree(ptrs[j]);
+	}
+
+	V(sem);
+}
+
+int
+mallocscale(int nargs, char **args)
+{
+	struct semaphore *sem;
+	unsigned ncpus, nthreads, i;
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	unsigned long usecs;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	sem = sem_create("mallocscale", 0);
+	if (sem == NULL) {
+		panic("mallocscale: sem_create failed\n");
+	}
+
+	for (ncpus=0; cpu_bynumber(ncpus) != NULL; ncpus++) {
+		/* nothing */
+	}
+
+	kprintf("Starting kmalloc scaling test...\n");
+
+	for (nthreads=1; nthreads<=ncpus; nthreads++) {
+		gettime(&secs1, &nsecs1);
+
+		for (i=0; i<nthreads; i++) {
+			result = thread_fork("mallocscale", NULL,
+					     mallocscalethread, sem, i);
+			if (result) {
+				panic("mallocscale: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<nthreads; i++) {
+			P(sem);
+		}
+
+		gettime(&secs2, &nsecs2);
+		getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+		usecs = secs2 * 1000000 + nsecs2 / 1000;
+		if (usecs == 0) {
+			usecs = 1;
+		}
+
+		kprintf("km3: %u thread(s): %lu us, %lu allocs/sec\n",
+			nthreads, usecs,
+			(unsigned long)((uint64_t)nthreads * NTRIES3 *
+					1000000 / usecs));
+	}
+
+	sem_destroy(sem);
+	kprintf("kmalloc scaling test done\n");
+
+	return 0;
+}
+
+/*
+ * kfree benchmark: times NTRIES4 kfree/kmalloc pairs of a small block
+ * with the heap as it is, then again after growing the heap by up to
+ * NGROW4 pages of other blocks. kfree has to find the page a block is
+ * on; this shows whether that costs more as the heap grows. (Walking
+ * a list of every page did, since new pages went on the front.)
+ */
+
+#define NTRIES4   20000
+#define NGROW4    64
+
+static
+unsigned long
+mallocfreetime(void **ptr)
+{
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	unsigned i;
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NTRIES4 && *ptr != NULL; i++) {
+		kfree(*ptr);
+		*ptr = kmalloc(16);
+	}
+	gettime(&secs2, &nsecs2);
+	getinterval(secs1, nsecs1, secs2, nsecs2, &secs2, &nsecs2);
+
+	/* nanoseconds per pair */
+	return (unsigned long)(((uint64_t)secs2 * 1000000000 + nsecs2) /
+			       NTRIES4);
+}
+
+int
+mallocfreebench(int nargs, char **args)
+{
+	void *grow[NGROW4 * 2];
+	void *ptr;
+	unsigned long before, after;
+	unsigned i, n;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting kfree benchmark...\n");
+
+	ptr = kmalloc(16);
+	if (ptr == NULL) {
+		kprintf("km4: kmalloc returned NULL\n");
+		return ENOMEM;
+	}
+	before = mallocfreetime(&ptr);
+
+	/* Two 2048-byte blocks to a page */
+	for (n=0; n<NGROW4 * 2; n++) {
+		grow[n] = kmalloc(2048);
+		if (grow[n] == NULL) {
+			break;
+		}
+	}
+	after = mallocfreetime(&ptr);
+
+	for (i=0; i<n; i++) {
+		kfree(grow[i]);
+	}
+	if (ptr == NULL) {
+		kprintf("km4: kmalloc returned NULL\n");
+		return ENOMEM;
+	}
+	kfree(ptr);
+
+	kprintf("km4: %lu ns per kfree/kmalloc\n", before);
+	kprintf("km4: %lu ns per kfree/kmalloc with %u more heap pages\n",
+		after, n / 2);
+	kprintf("kfree benchmark done\n");
+
+	return 0;
+}
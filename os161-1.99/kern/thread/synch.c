@@ -30,6 +30,12 @@
 /*
  * Synchronization primitives.
  * The specifications of the functions are in synch.h.
+ *
+ * Semaphores, locks, and CVs embedded in some other structure are set
+ * up with sem_init, lock_init, and cv_init, which allocate nothing:
+ * the wait channel is part of the primitive and the name isn't copied.
+ * The _create versions get the structure from an object cache (see
+ * kmemcache.h), copy the name, and then do the same.
  */
 
 #include <types.h>
@@ -38,39 +44,58 @@
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
+#include <kmemcache.h>
 #include <synch.h>
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore),
+			       NULL, NULL, KC_MAXFREE);
+
+void
+sem_init(struct semaphore *sem, const char *name, int initial_count)
+{
+        KASSERT(initial_count >= 0);
+
+        sem->sem_name = name;
+	wchan_init(&sem->sem_wchan, name);
+	spinlock_init(&sem->sem_lock);
+        sem->sem_count = initial_count;
+}
+
+void
+sem_cleanup(struct semaphore *sem)
+{
+        KASSERT(sem != NULL);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&sem->sem_lock);
+	wchan_cleanup(&sem->sem_wchan);
+}
+
 struct semaphore *
 sem_create(const char *name, int initial_count)
 {
         struct semaphore *sem;
+        char *namecopy;
 
         KASSERT(initial_count >= 0);
 
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = kmem_cache_alloc(&sem_cache);
         if (sem == NULL) {
                 return NULL;
         }
 
-        sem->sem_name = kstrdup(name);
-        if (sem->sem_name == NULL) {
-                kfree(sem);
+        namecopy = kstrdup(name);
+        if (namecopy == NULL) {
+                kmem_cache_free(&sem_cache, sem);
                 return NULL;
         }
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
-
-	spinlock_init(&sem->sem_lock);
-        sem->sem_count = initial_count;
+	sem_init(sem, namecopy, initial_count);
 
         return sem;
 }
@@ -78,13 +103,15 @@ sem_create(const char *name, int initial_count)
 void
 sem_destroy(struct semaphore *sem)
 {
+        char *namecopy;
+
         KASSERT(sem != NULL);
 
-	/* wchan_cleanup will assert if anyone's waiting on it */
-	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
-        kfree(sem->sem_name);
-        kfree(sem);
+	/* the copy made by sem_create */
+	namecopy = (char *)sem->sem_name;
+	sem_cleanup(sem);
+        kfree(namecopy);
+        kmem_cache_free(&sem_cache, sem);
 }
 
 void 
@@ -118,9 +145,9 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
-		wchan_lock(sem->sem_wchan);
+		wchan_lock(&sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
-                wchan_sleep(sem->sem_wchan);
+                wchan_sleep(&sem->sem_wchan);
 
 		spinlock_acquire(&sem->sem_lock);
         }
@@ -138,7 +165,7 @@ V(struct semaphore *sem)
 
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	wchan_wakeone(&sem->sem_wchan);
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -147,30 +174,46 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock),
+			       NULL, NULL, KC_MAXFREE);
+
+void
+lock_init(struct lock *lock, const char *name)
+{
+        lock->lk_name = name;
+		wchan_init(&lock->lk_wchan, name);
+		spinlock_init(&lock->lk_spinlk);
+		lock->lk_mother = NULL;
+		lock->lk_status = false;
+}
+
+void
+lock_cleanup(struct lock *lock)
+{
+        KASSERT(lock != NULL);
+		KASSERT(lock->lk_status == false);
+		spinlock_cleanup(&lock->lk_spinlk);
+		wchan_cleanup(&lock->lk_wchan);
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
+        char *namecopy;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = kmem_cache_alloc(&lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
+        namecopy = kstrdup(name);
+        if (namecopy == NULL) {
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
-		lock->lk_wchan = wchan_create(lock->lk_name);
-		if(lock->lk_wchan == NULL) {
-			kfree(lock->lk_name);
-			kfree(lock);
-			return NULL;
-		}
-		spinlock_init(&lock->lk_spinlk);
-		lock->lk_mother = NULL;
-		lock->lk_status = false;
+		lock_init(lock, namecopy);
         // add stuff here as needed
         
         return lock;
@@ -179,13 +222,15 @@ lock_create(const char *name)
 void
 lock_destroy(struct lock *lock)
 {
+        char *namecopy;
+
         KASSERT(lock != NULL);
-		KASSERT(lock->lk_status == false);		
         // add stuff here as needed
-        spinlock_cleanup(&lock->lk_spinlk);
-		wchan_destroy(lock->lk_wchan);
-		kfree(lock->lk_name);
-        kfree(lock);
+		/* the copy made by lock_create */
+		namecopy = (char *)lock->lk_name;
+		lock_cleanup(lock);
+		kfree(namecopy);
+        kmem_cache_free(&lock_cache, lock);
 }
 
 void
@@ -204,9 +249,9 @@ lock_acquire(struct lock *lock)
 
 	spinlock_acquire(&lock->lk_spinlk);
 	while(lock->lk_status == true) {
-		wchan_lock(lock->lk_wchan);
+		wchan_lock(&lock->lk_wchan);
 		spinlock_release(&lock->lk_spinlk);
-		wchan_sleep(lock->lk_wchan);
+		wchan_sleep(&lock->lk_wchan);
 		spinlock_acquire(&lock->lk_spinlk);
 	}
 	KASSERT(lock->lk_status == false);
@@ -230,7 +275,7 @@ lock_release(struct lock *lock)
 	spinlock_acquire(&lock->lk_spinlk);
 	lock->lk_status = false;
 	lock->lk_mother = NULL;
-	wchan_wakeone(lock->lk_wchan);
+	wchan_wakeone(&lock->lk_wchan);
 	spinlock_release(&lock->lk_spinlk); 
 }
 
@@ -257,28 +302,43 @@ lock_do_i_hold(struct lock *lock)
 // CV
 
 
+static struct kmem_cache cv_cache =
+	KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv),
+			       NULL, NULL, KC_MAXFREE);
+
+void
+cv_init(struct cv *cv, const char *name)
+{
+        cv->cv_name = name;
+        wchan_init(&cv->cv_wchan, name);
+}
+
+void
+cv_cleanup(struct cv *cv)
+{
+        KASSERT(cv != NULL);
+
+        wchan_cleanup(&cv->cv_wchan);
+}
+
 struct cv *
 cv_create(const char *name)
 {
 	//cv only contains a name and a wait channel
         struct cv *cv;
+        char *namecopy;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
-        cv->cv_name = kstrdup(name);
-        if (cv->cv_name == NULL) {
-                kfree(cv);
+        namecopy = kstrdup(name);
+        if (namecopy == NULL) {
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
-        cv->cv_wchan = wchan_create(cv->cv_name);
-		if(cv->cv_wchan == NULL) {
-			kfree(cv->cv_name);
-			kfree(cv);
-			return NULL;
-		}
+        cv_init(cv, namecopy);
 
         return cv;
 }
@@ -286,11 +346,15 @@ cv_create(const char *name)
 void
 cv_destroy(struct cv *cv)
 {
+        char *namecopy;
+
         KASSERT(cv != NULL);
 
-        wchan_destroy(cv->cv_wchan);
-        kfree(cv->cv_name);
-        kfree(cv);
+        /* the copy made by cv_create */
+        namecopy = (char *)cv->cv_name;
+        cv_cleanup(cv);
+        kfree(namecopy);
+        kmem_cache_free(&cv_cache, cv);
 }
 
 void
@@ -304,9 +368,9 @@ cv_wait(struct cv *cv, struct lock *lock)
 	 * in the course notes.
 	 */
 
-	wchan_lock(cv->cv_wchan);
+	wchan_lock(&cv->cv_wchan);
 	lock_release(lock);
-	wchan_sleep(cv->cv_wchan);
+	wchan_sleep(&cv->cv_wchan);
 	lock_acquire(lock);
 }
 
@@ -316,7 +380,7 @@ cv_signal(struct cv *cv, struct lock *lock)
 	KASSERT(cv != NULL);
 	KASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
-	wchan_wakeone(cv->cv_wchan);
+	wchan_wakeone(&cv->cv_wchan);
 }
 
 void
@@ -325,5 +389,5 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	KASSERT(cv != NULL);
 	KASSERT(lock != NULL);
 	KASSERT(curthread->t_in_interrupt == false);
-	wchan_wakeall(cv->cv_wchan);
+	wchan_wakeall(&cv->cv_wchan);
 }
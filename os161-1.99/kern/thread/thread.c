@@ -50,6 +50,7 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmemcache.h>
 
 #include "opt-synchprobs.h"
 
@@ -57,12 +58,17 @@
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
-/* Wait channel. */
-struct wchan {
-	const char *wc_name;		/* name for this channel */
-	struct threadlist wc_threads;	/* list of waiting threads */
-	struct spinlock wc_lock;	/* lock for mutual exclusion */
-};
+/*
+ * Object caches for thread structures and their stacks, so a process
+ * that exits leaves both warm for the next fork. Stacks are a whole
+ * page each, so fewer of them are kept.
+ */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread),
+			       NULL, NULL, KC_MAXFREE);
+static struct kmem_cache thread_stack_cache =
+	KMEM_CACHE_INITIALIZER("thread stack", STACK_SIZE,
+			       NULL, NULL, 4);
 
 /* Master array of CPUs. */
 DECLARRAY(cpu);
@@ -123,14 +129,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(&thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -180,6 +186,16 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	bzero(c->c_vmstats, sizeof(c->c_vmstats));
+	bzero(c->c_kmag_count, sizeof(c->c_kmag_count));
+#if OPT_A3
+	spinlock_init(&c->c_pagemag_lock);
+	c->c_pagemag_count = 0;
+	c->c_asid = 0;
+	c->c_tlbpid = 0;
+	bzero(c->c_stlb_lo, sizeof(c->c_stlb_lo));
+	c->c_curas = NULL;
+#endif
 
 	c->c_isidle = false;
 	threadlist_init(&c->c_runqueue);
@@ -187,6 +203,8 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdown_sent = 0;
+	c->c_shootdown_done = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -214,7 +232,7 @@ cpu_create(unsigned hardware_number)
 		/*c->c_curthread->t_stack = ... */
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
+		c->c_curthread->t_stack = kmem_cache_alloc(&thread_stack_cache);
 		if (c->c_curthread->t_stack == NULL) {
 			panic("cpu_create: couldn't allocate stack");
 		}
@@ -250,7 +268,7 @@ thread_destroy(struct thread *thread)
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
 	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
+		kmem_cache_free(&thread_stack_cache, thread->t_stack);
 	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
@@ -259,7 +277,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -493,7 +511,7 @@ thread_fork(const char *name,
 	}
 
 	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
+	newthread->t_stack = kmem_cache_alloc(&thread_stack_cache);
 	if (newthread->t_stack == NULL) {
 		thread_destroy(newthread);
 		return ENOMEM;
@@ -980,9 +998,7 @@ wchan_create(const char *name)
 	if (wc == NULL) {
 		return NULL;
 	}
-	spinlock_init(&wc->wc_lock);
-	threadlist_init(&wc->wc_threads);
-	wc->wc_name = name;
+	wchan_init(wc, name);
 	return wc;
 }
 
@@ -992,10 +1008,31 @@ wchan_create(const char *name)
  */
 void
 wchan_destroy(struct wchan *wc)
+{
+	wchan_cleanup(wc);
+	kfree(wc);
+}
+
+/*
+ * Initialize a wait channel that's part of some other structure.
+ */
+void
+wchan_init(struct wchan *wc, const char *name)
+{
+	spinlock_init(&wc->wc_lock);
+	threadlist_init(&wc->wc_threads);
+	wc->wc_name = name;
+}
+
+/*
+ * Clean up a wait channel that's part of some other structure. Must
+ * be empty and unlocked.
+ */
+void
+wchan_cleanup(struct wchan *wc)
 {
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
 }
 
 /*
@@ -1140,26 +1177,76 @@ ipi_broadcast(int code)
 	}
 }
 
-void
+unsigned
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	int n;
+	return ipi_tlbshootdown_many(target, mapping, 1);
+}
+
+unsigned
+ipi_tlbshootdown_many(struct cpu *target,
+		      const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i, ticket;
+	int num;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	num = target->c_numshootdown;
+	if (num != TLBSHOOTDOWN_ALL) {
+		if ((unsigned)num + n > TLBSHOOTDOWN_MAX) {
+			/* Not worth doing one at a time. */
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+		}
+		else {
+			for (i=0; i<n; i++) {
+				target->c_shootdown[num + i] = mappings[i];
+			}
+			target->c_numshootdown = num + n;
+		}
 	}
+	ticket = ++target->c_shootdown_sent;
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+
+	return ticket;
+}
+
+/*
+ * Wait for TARGET to do the shootdowns with ticket TICKET. This needs
+ * interrupts on, in case TARGET is waiting for us at the same time.
+ */
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	unsigned done;
+
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(target != curcpu->c_self);
+
+	while (1) {
+		spinlock_acquire(&target->c_ipi_lock);
+		done = target->c_shootdown_done;
+		spinlock_release(&target->c_ipi_lock);
+
+		/* (int) so that wrapping around is harmless */
+		if ((int)(done - ticket) >= 0) {
+			break;
+		}
+		thread_yield();
+	}
+}
+
+struct cpu *
+cpu_bynumber(unsigned num)
+{
+	if (num >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, num);
 }
 
 void
@@ -1202,6 +1289,7 @@ interprocessor_interrupt(void)
 			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdown_done = curcpu->c_shootdown_sent;
 	}
 
 	curcpu->c_ipi_pending = 0;
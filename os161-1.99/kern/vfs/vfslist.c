@@ -43,6 +43,10 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include "opt-A3.h"
+#if OPT_A3
+#include <pagecache.h>
+#endif
 
 /*
  * Structure for a single named device.
@@ -88,7 +92,7 @@ DEFARRAY(knowndev, /*no inline*/);
 static struct knowndevarray *knowndevs;
 
 /* The big lock for all FS ops. Remove for filesystem assignment. */
-static struct lock *vfs_biglock;
+static struct lock vfs_biglock;
 static unsigned vfs_biglock_depth;
 
 
@@ -103,10 +107,7 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
-	vfs_biglock = lock_create("vfs_biglock");
-	if (vfs_biglock==NULL) {
-		panic("vfs: Could not create vfs big lock\n");
-	}
+	lock_init(&vfs_biglock, "vfs_biglock");
 	vfs_biglock_depth = 0;
 
 	devnull_create();
@@ -122,8 +123,8 @@ vfs_bootstrap(void)
 void
 vfs_biglock_acquire(void)
 {
-	if (!lock_do_i_hold(vfs_biglock)) {
-		lock_acquire(vfs_biglock);
+	if (!lock_do_i_hold(&vfs_biglock)) {
+		lock_acquire(&vfs_biglock);
 	}
 	vfs_biglock_depth++;
 }
@@ -131,18 +132,18 @@ vfs_biglock_acquire(void)
 void
 vfs_biglock_release(void)
 {
-	KASSERT(lock_do_i_hold(vfs_biglock));
+	KASSERT(lock_do_i_hold(&vfs_biglock));
 	KASSERT(vfs_biglock_depth > 0);
 	vfs_biglock_depth--;
 	if (vfs_biglock_depth == 0) {
-		lock_release(vfs_biglock);
+		lock_release(&vfs_biglock);
 	}
 }
 
 bool
 vfs_biglock_do_i_hold(void)
 {
-	return lock_do_i_hold(vfs_biglock);
+	return lock_do_i_hold(&vfs_biglock);
 }
 
 /*
@@ -549,7 +550,9 @@ vfs_mount(const char *devname, void *data,
 
 /*
  * Unmount a filesystem/device by name.
- * First calls FSOP_SYNC on the filesystem; then calls FSOP_UNMOUNT.
+ * First drops the filesystem's files from the page cache, which holds
+ * references to them; then calls FSOP_SYNC on the filesystem; then
+ * calls FSOP_UNMOUNT.
  */
 int
 vfs_unmount(const char *devname)
@@ -571,6 +574,10 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+#if OPT_A3
+	pagecache_flush(kd->kd_fs);
+#endif
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
@@ -619,6 +626,10 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+#if OPT_A3
+		pagecache_flush(dev->kd_fs);
+#endif
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
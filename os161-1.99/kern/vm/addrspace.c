@@ -0,0 +1,1039 @@
+/*
+ * Address spaces for the paged VM system.
+ *
+ * An address space is a list of regions plus a two-level page table.
+ * Defining a region only records its bounds and permissions; frames
+ * are allocated one page at a time by vm_fault when the page is first
+ * touched, so memory use follows the pages a program actually uses
+ * rather than the size of its segments. Program text and data are not
+ * read in by load_elf either: each region remembers where its part of
+ * the executable is, and vm_fault reads a page at a time.
+ *
+ * as_copy does not copy any pages. Parent and child share every
+ * resident frame, with both PTEs marked PTE_COW and the frame's
+ * coremap reference count raised (the shared zero page is always
+ * copy-on-write, and isn't counted); the first write from either side
+ * takes a private copy in vm_fault. Pages that are out on swap are
+ * shared the same way, by taking another reference to the swap slot.
+ * Pages of MAP_SHARED mappings are shared plainly, not copy-on-write,
+ * so both sides keep seeing each other's writes; those that are out on
+ * swap are read back in first, as both must map the same frame.
+ *
+ * Page replacement may change any address space's page table, at any
+ * time, without taking its lock. It only ever changes the PTEs of
+ * frames it has marked busy, though, so as_copy, as_destroy and
+ * as_unmap pin each frame (coremap_pin) before they touch its PTE,
+ * waiting for it first if it is on its way out to swap.
+ *
+ * TLB entries are tagged with a 6-bit address space ID, so switching
+ * address spaces doesn't flush the TLB. Each cpu hands out ASIDs in
+ * order, counting generations in the upper bits of c_asid; an address
+ * space's ASID on a cpu is good as long as it is from that cpu's
+ * current generation. When a cpu runs out, it flushes its TLB and
+ * starts a new generation, which invalidates every ASID it had given
+ * out. To drop all of one address space's TLB entries everywhere, it
+ * is enough to forget its ASIDs.
+ *
+ * The same trick keeps TLB shootdowns cheap: a cpu that isn't using
+ * the address space right now doesn't need an IPI, since its ASID
+ * can just be forgotten instead. as_tlblock keeps a cpu from starting
+ * to use the address space in the middle of that.
+ *
+ * The heap is one more region, starting on the page after the highest
+ * part of the executable. It is created empty by as_complete_load and
+ * grows and shrinks with as_sbrk; pages above the new break are freed
+ * as soon as it moves down past them.
+ *
+ * The stack is a region too, big enough for the program's arguments to
+ * begin with. vm_fault calls as_growstack on a fault below it, which
+ * extends it if the address isn't far below the stack pointer, up to
+ * the stack size limit. Nothing else is ever placed in the space
+ * the stack may grow into, nor in the guard page below that, so a
+ * stack overflow is a clean fault in the guard page.
+ *
+ * mmap regions are placed top-down below that guard page, in the
+ * first gap big enough. munmap only takes whole mappings. File
+ * mappings map the page cache's frames (see vm/vm.c). Pages of shared
+ * ones that have been written are marked PTE_DIRTY, and are written
+ * back to the file with VOP_WRITE by munmap, fsync and as_destroy;
+ * since the frame is the cached page itself, that just sends it on to
+ * disk.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/iovec.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <limits.h>
+#include <spl.h>
+#include <cpu.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <stat.h>
+#include <uio.h>
+#include <mips/tlb.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <swap.h>
+#include <uw-vmstats.h>
+#include <vm.h>
+
+/* The generation part of an ASID */
+#define ASID_GENERATION(asid)	((asid) & ~(uint32_t)(NUM_TLBPID - 1))
+
+/* Stack size limit for new address spaces, in bytes. */
+static size_t as_stacklimit = VM_STACKLIMIT_DEFAULT;
+
+/* Lowest address reserved for AS's stack, including the guard page. */
+#define AS_STACKFLOOR(as) \
+	(USERSTACK - ((as)->as_stackmax + 1) * PAGE_SIZE)
+
+static void as_forget_tlb(struct addrspace *as);
+
+struct addrspace *
+as_create(void)
+{
+	struct addrspace *as;
+	unsigned i;
+
+	as = kmalloc(sizeof(struct addrspace));
+	if (as == NULL) {
+		return NULL;
+	}
+
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	lock_init(&as->as_lock, "addrspace");
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	as->as_heaptop = 0;
+	as->as_stack = NULL;
+	as->as_stackmax = 0;
+	for (i = 0; i < AS_MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	spinlock_init(&as->as_tlblock);
+
+	return as;
+}
+
+/*
+ * Drop the reference to frame PA that PTE, for VADDR in VR, held. The
+ * caller has PA pinned.
+ */
+static
+void
+as_putframe(struct vm_region *vr, vaddr_t vaddr, pte_t pte, paddr_t pa)
+{
+	if ((pte & PTE_PCACHE) == 0) {
+		coremap_decref_busy(pa);
+		return;
+	}
+	if (vr->vr_flags & VR_SHARED) {
+		pagecache_unshare(vr->vr_vnode, VR_FILEOFF(vr, vaddr), pa);
+	}
+	pagecache_release_busy(pa);
+}
+
+/*
+ * pt_walk callback for as_destroy: release one page, resident or in
+ * swap.
+ */
+static
+int
+as_freepage(vaddr_t vaddr, pte_t *pte, void *data)
+{
+	struct addrspace *as = data;
+	paddr_t pa;
+
+	if (*pte & PTE_ZERO) {
+		/* The zero page isn't counted. */
+		*pte = 0;
+		return 0;
+	}
+
+	/* Wait for it if it's on its way out to swap. */
+	pa = coremap_pin(pte);
+	if (pa != 0) {
+		as_putframe(as_find_region(as, vaddr), vaddr, *pte, pa);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_decref(PTE_SLOT(*pte));
+	}
+	*pte = 0;
+	return 0;
+}
+
+void
+as_destroy(struct addrspace *as)
+{
+	struct vm_region *vr;
+
+	KASSERT(as != NULL);
+
+	/* Nobody will be told if this fails, but there's no one to tell. */
+	as_sync(as, NULL);
+
+	lock_acquire(&as->as_lock);
+	pt_walk(as->as_pt, as_freepage, as);
+	lock_release(&as->as_lock);
+	pt_destroy(as->as_pt);
+
+	while (as->as_regions != NULL) {
+		vr = as->as_regions;
+		as->as_regions = vr->vr_next;
+		if (vr->vr_vnode != NULL) {
+			vfs_close(vr->vr_vnode);
+		}
+		kfree(vr);
+	}
+	spinlock_cleanup(&as->as_tlblock);
+	lock_cleanup(&as->as_lock);
+	kfree(as);
+}
+
+/*
+ * pt_walk callback for as_copy: share one page copy-on-write, or for
+ * a shared mapping, just share it.
+ */
+static
+int
+as_copypage(vaddr_t vaddr, pte_t *pte, void *data)
+{
+	struct addrspace *new = data;
+	struct vm_region *vr;
+	pte_t *newpte;
+	paddr_t pa;
+	int result;
+
+	newpte = pt_lookup(new->as_pt, vaddr, true);
+	if (newpte == NULL) {
+		return ENOMEM;
+	}
+
+	vr = as_find_region(new, vaddr);
+	KASSERT(vr != NULL);
+	if (vr->vr_flags & VR_SHARED) {
+		/*
+		 * Both must see the same frame, so the page can't stay
+		 * on swap. (A fresh frame isn't pageable until it has
+		 * been touched, so the second pin always works.)
+		 */
+		while ((pa = coremap_pin(pte)) == 0) {
+			if (*pte == 0) {
+				/* A file page, evicted just now. */
+				return 0;
+			}
+			KASSERT(*pte & PTE_SWAPPED);
+			result = vm_swapin(pte);
+			if (result) {
+				return result;
+			}
+		}
+		KASSERT((*pte & (PTE_COW|PTE_ZERO)) == 0);
+		coremap_incref(pa);
+		if (*pte & PTE_PCACHE) {
+			pagecache_share(vr->vr_vnode, VR_FILEOFF(vr, vaddr),
+					pa);
+		}
+		/* Only the parent's PTE says it needs writing back. */
+		*newpte = *pte & ~(pte_t)PTE_DIRTY;
+		coremap_unbusy(pa);
+	}
+	else if (*pte & PTE_ZERO) {
+		KASSERT(*pte & PTE_COW);
+		*newpte = *pte;
+	}
+	else if ((pa = coremap_pin(pte)) != 0) {
+		/* Once shared, it can't be a victim; it is no longer busy. */
+		coremap_incref(pa);
+		*pte |= PTE_COW;
+		*newpte = *pte;
+		coremap_unbusy(pa);
+	}
+	else if (*pte & PTE_SWAPPED) {
+		swap_incref(PTE_SLOT(*pte));
+		*newpte = *pte;
+	}
+	else {
+		/* A page cache page, evicted just now; nothing to share. */
+		KASSERT(*pte == 0);
+	}
+	return 0;
+}
+
+int
+as_copy(struct addrspace *old, struct addrspace **ret)
+{
+	struct addrspace *new;
+	struct vm_region *vr, *newvr;
+	int result;
+
+	new = as_create();
+	if (new == NULL) {
+		return ENOMEM;
+	}
+
+	for (vr = old->as_regions; vr != NULL; vr = vr->vr_next) {
+		newvr = kmalloc(sizeof(struct vm_region));
+		if (newvr == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		*newvr = *vr;
+		/* Nothing of the child's is in any TLB yet. */
+		newvr->vr_fa_start = newvr->vr_fa_end = 0;
+		if (newvr->vr_vnode != NULL) {
+			VOP_INCOPEN(newvr->vr_vnode);
+			VOP_INCREF(newvr->vr_vnode);
+		}
+		newvr->vr_next = new->as_regions;
+		new->as_regions = newvr;
+		if (vr == old->as_heap) {
+			new->as_heap = newvr;
+		}
+		if (vr == old->as_stack) {
+			new->as_stack = newvr;
+		}
+	}
+	new->as_heaptop = old->as_heaptop;
+	new->as_stackmax = old->as_stackmax;
+
+	lock_acquire(&old->as_lock);
+	result = pt_walk(old->as_pt, as_copypage, new);
+	lock_release(&old->as_lock);
+
+	/*
+	 * The parent may have writable TLB entries, on this cpu or on
+	 * others it has run on, for pages that are now copy-on-write.
+	 */
+	as_forget_tlb(old);
+
+	if (result) {
+		as_destroy(new);
+		return result;
+	}
+
+	*ret = new;
+	return 0;
+}
+
+/*
+ * Forget all of AS's ASIDs, so that any TLB entries it has on any cpu
+ * can never match again. If AS is current, it gets a new ASID here.
+ */
+static
+void
+as_forget_tlb(struct addrspace *as)
+{
+	unsigned i;
+
+	spinlock_acquire(&as->as_tlblock);
+	for (i = 0; i < AS_MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+	}
+	spinlock_release(&as->as_tlblock);
+
+	if (as == curproc_getas()) {
+		as_activate();
+	}
+}
+
+int
+as_tlbpid(struct addrspace *as)
+{
+	struct cpu *c = curcpu->c_self;
+	uint32_t asid;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(c->c_number < AS_MAXCPUS);
+
+	asid = as->as_asid[c->c_number];
+	if (asid == 0 ||
+	    ASID_GENERATION(asid) != ASID_GENERATION(c->c_asid)) {
+		return -1;
+	}
+	return asid & (NUM_TLBPID - 1);
+}
+
+void
+as_activate(void)
+{
+	int i, spl;
+	struct addrspace *as;
+	struct cpu *c;
+	uint32_t asid;
+	bool flushed;
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/* Kernel threads don't have an address spaces to activate */
+		return;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	c = curcpu->c_self;
+	KASSERT(c->c_number < AS_MAXCPUS);
+
+	spinlock_acquire(&as->as_tlblock);
+
+	flushed = false;
+	if (as_tlbpid(as) < 0) {
+		asid = ++c->c_asid;
+		if ((asid & (NUM_TLBPID - 1)) == 0) {
+			/*
+			 * Out of ASIDs. Start a new generation with an
+			 * empty TLB. (If the counter itself wraps, start
+			 * over at generation 1; generation 0 ASIDs are
+			 * ancient history by then.)
+			 */
+			for (i=0; i<NUM_TLB; i++) {
+				tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+			}
+			vm_stlb_flush();
+			flushed = true;
+			if (asid == 0) {
+				asid = NUM_TLBPID;
+				c->c_asid = asid;
+			}
+		}
+		as->as_asid[c->c_number] = asid;
+	}
+
+	c->c_tlbpid = as->as_asid[c->c_number] & (NUM_TLBPID - 1);
+	c->c_curas = as;
+	tlb_setpid(c->c_tlbpid);
+
+	spinlock_release(&as->as_tlblock);
+	splx(spl);
+
+	vmstats_inc(flushed ? VMSTAT_TLB_INVALIDATE :
+		    VMSTAT_TLB_INVALIDATE_AVOIDED);
+}
+
+void
+as_tlbshootdown(struct addrspace *as, const vaddr_t *vaddrs, unsigned n,
+		bool wait)
+{
+	struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+	unsigned tickets[AS_MAXCPUS];
+	uint32_t sent;
+	struct cpu *c;
+	unsigned i, me, nsent;
+
+	KASSERT(n > 0 && n <= TLBSHOOTDOWN_MAX);
+
+	for (i = 0; i < n; i++) {
+		ts[i].ts_addrspace = as;
+		ts[i].ts_vaddr = vaddrs[i];
+	}
+
+	spinlock_acquire(&as->as_tlblock);
+
+	/* This cpu can do its own. */
+	for (i = 0; i < n; i++) {
+		vm_tlbshootdown(&ts[i]);
+	}
+
+	sent = 0;
+	nsent = 0;
+	me = curcpu->c_number;
+	for (i = 0; i < AS_MAXCPUS; i++) {
+		if (i == me || as->as_asid[i] == 0) {
+			continue;
+		}
+		c = cpu_bynumber(i);
+		KASSERT(c != NULL);
+		if (c->c_curas != as) {
+			/* It gets a fresh ASID if it ever uses AS again. */
+			as->as_asid[i] = 0;
+			continue;
+		}
+		tickets[i] = ipi_tlbshootdown_many(c, ts, n);
+		sent |= (uint32_t)1 << i;
+		nsent++;
+	}
+
+	spinlock_release(&as->as_tlblock);
+
+	if (wait) {
+		for (i = 0; i < AS_MAXCPUS; i++) {
+			if (sent & ((uint32_t)1 << i)) {
+				ipi_tlbshootdown_wait(cpu_bynumber(i),
+						      tickets[i]);
+			}
+		}
+	}
+
+	for (i = 0; i < nsent; i++) {
+		vmstats_inc(VMSTAT_SHOOTDOWN_IPI);
+	}
+	for (i = 0; i < nsent * n; i++) {
+		vmstats_inc(VMSTAT_SHOOTDOWN_PAGE);
+	}
+}
+
+void
+as_deactivate(void)
+{
+	/* nothing */
+}
+
+struct vm_region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
+{
+	struct vm_region *vr;
+
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr >= vr->vr_base &&
+		    vaddr < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+			return vr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Add a region to AS without any checks.
+ */
+static
+struct vm_region *
+as_newregion(struct addrspace *as, vaddr_t vaddr, size_t npages,
+	     unsigned flags)
+{
+	struct vm_region *vr;
+
+	vr = kmalloc(sizeof(struct vm_region));
+	if (vr == NULL) {
+		return NULL;
+	}
+	vr->vr_base = vaddr;
+	vr->vr_npages = npages;
+	vr->vr_flags = flags;
+	vr->vr_vnode = NULL;
+	vr->vr_offset = 0;
+	vr->vr_fileva = 0;
+	vr->vr_filesize = 0;
+	vr->vr_fa_start = 0;
+	vr->vr_fa_end = 0;
+	vr->vr_fa_window = VM_FAULTAROUND_INIT;
+	vr->vr_next = as->as_regions;
+	as->as_regions = vr;
+
+	return vr;
+}
+
+int
+as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		 int readable, int writeable, int executable)
+{
+	struct vm_region *vr;
+	vaddr_t top;
+	size_t npages;
+
+	/* Align the region. First, the base... */
+	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
+	vaddr &= PAGE_FRAME;
+
+	/* ...and now the length. */
+	sz = (sz + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	npages = sz / PAGE_SIZE;
+	top = vaddr + sz;
+	if (npages == 0 || top > USERSPACETOP || top < vaddr) {
+		return EFAULT;
+	}
+
+	/* Regions may not overlap. */
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vaddr < vr->vr_base + vr->vr_npages * PAGE_SIZE &&
+		    vr->vr_base < top) {
+			return EINVAL;
+		}
+	}
+
+	vr = as_newregion(as, vaddr, npages, (readable ? VR_READ : 0) |
+			  (writeable ? VR_WRITE : 0) |
+			  (executable ? VR_EXEC : 0));
+	if (vr == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+int
+as_define_file(struct addrspace *as, vaddr_t vaddr, struct vnode *v,
+	       off_t offset, size_t filesize)
+{
+	struct vm_region *vr;
+
+	vr = as_find_region(as, vaddr);
+	if (vr == NULL || vr->vr_vnode != NULL) {
+		return EINVAL;
+	}
+	if (filesize > vr->vr_base + vr->vr_npages * PAGE_SIZE - vaddr) {
+		return ENOEXEC;
+	}
+
+	VOP_INCOPEN(v);
+	VOP_INCREF(v);
+	vr->vr_vnode = v;
+	vr->vr_offset = offset;
+	vr->vr_fileva = vaddr;
+	vr->vr_filesize = filesize;
+	return 0;
+}
+
+int
+as_prepare_load(struct addrspace *as)
+{
+	/*
+	 * Nothing to allocate up front, and load_elf doesn't write
+	 * into the regions, so read-only ones can be read-only from
+	 * the start.
+	 */
+	(void)as;
+	return 0;
+}
+
+int
+as_complete_load(struct addrspace *as)
+{
+	struct vm_region *vr;
+	vaddr_t heapbase;
+
+	/* Start the (empty) heap above everything that got loaded. */
+	heapbase = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (vr->vr_base + vr->vr_npages * PAGE_SIZE > heapbase) {
+			heapbase = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		}
+	}
+	KASSERT(as->as_heap == NULL);
+	as->as_heap = as_newregion(as, heapbase, 0, VR_READ | VR_WRITE);
+	if (as->as_heap == NULL) {
+		return ENOMEM;
+	}
+	as->as_heaptop = heapbase;
+	return 0;
+}
+
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+{
+	struct vm_region *vr;
+	vaddr_t top;
+	size_t maxpages, npages;
+
+	/*
+	 * Reserve room up to the limit, less whatever the executable
+	 * already occupies, leaving a guard page.
+	 */
+	maxpages = as_stacklimit / PAGE_SIZE;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+		if (top > USERSTACK - (maxpages + 1) * PAGE_SIZE) {
+			if (top + 2 * PAGE_SIZE > USERSTACK) {
+				return ENOMEM;
+			}
+			maxpages = (USERSTACK - top) / PAGE_SIZE - 1;
+		}
+	}
+
+	/*
+	 * Start with room for the arguments, which the kernel copies
+	 * out before there is any user stack pointer to go by.
+	 */
+	npages = (ARG_MAX + PAGE_SIZE - 1) / PAGE_SIZE + 1;
+	if (npages > maxpages) {
+		npages = maxpages;
+	}
+
+	KASSERT(as->as_stack == NULL);
+	as->as_stack = as_newregion(as, USERSTACK - npages * PAGE_SIZE,
+				    npages, VR_READ | VR_WRITE);
+	if (as->as_stack == NULL) {
+		return ENOMEM;
+	}
+	as->as_stackmax = maxpages;
+
+	*stackptr = USERSTACK;
+	return 0;
+}
+
+struct vm_region *
+as_growstack(struct addrspace *as, vaddr_t vaddr, vaddr_t sp)
+{
+	struct vm_region *vr;
+
+	vr = as->as_stack;
+	if (vr == NULL || vaddr >= vr->vr_base) {
+		return NULL;
+	}
+	if (vaddr < USERSTACK - as->as_stackmax * PAGE_SIZE) {
+		/* The guard page, or beyond. */
+		return NULL;
+	}
+	if (vaddr + VM_STACKGROW_SLACK < sp) {
+		/* Too far below the stack pointer to be a stack access. */
+		return NULL;
+	}
+
+	vaddr &= PAGE_FRAME;
+
+	vr->vr_npages += (vr->vr_base - vaddr) / PAGE_SIZE;
+	vr->vr_base = vaddr;
+	return vr;
+}
+
+void
+as_set_stacklimit(size_t bytes)
+{
+	if (bytes < PAGE_SIZE) {
+		bytes = PAGE_SIZE;
+	}
+	if (bytes > VM_STACKLIMIT_MAX) {
+		bytes = VM_STACKLIMIT_MAX;
+	}
+	as_stacklimit = bytes & PAGE_FRAME;
+}
+
+size_t
+as_get_stacklimit(void)
+{
+	return as_stacklimit;
+}
+
+/*
+ * Shoot down the N pages of VR at VADDRS, then drop the frames the
+ * PTEs in OLDPTES had, which the caller has pinned (except for the
+ * zero page).
+ */
+static
+void
+as_unmap_batch(struct addrspace *as, struct vm_region *vr,
+	       const vaddr_t *vaddrs, const pte_t *oldptes, unsigned n)
+{
+	unsigned i;
+
+	as_tlbshootdown(as, vaddrs, n, true);
+	for (i = 0; i < n; i++) {
+		if ((oldptes[i] & PTE_ZERO) == 0) {
+			as_putframe(vr, vaddrs[i], oldptes[i],
+				    oldptes[i] & PTE_FRAME);
+		}
+	}
+}
+
+/*
+ * Throw away the NPAGES pages of VR at VADDR, resident or in swap.
+ * TLB entries are shot down a batch at a time, before the frames
+ * behind them are freed.
+ */
+static
+void
+as_unmap(struct addrspace *as, struct vm_region *vr, vaddr_t vaddr,
+	 size_t npages)
+{
+	vaddr_t vaddrs[TLBSHOOTDOWN_MAX];
+	pte_t oldptes[TLBSHOOTDOWN_MAX];
+	unsigned n;
+	pte_t *pte;
+
+	lock_acquire(&as->as_lock);
+
+	n = 0;
+	for (; npages > 0; npages--, vaddr += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte == NULL || *pte == 0) {
+			continue;
+		}
+		/* (The zero page just needs its TLB entry gone.) */
+		if ((*pte & PTE_ZERO) == 0 && coremap_pin(pte) == 0) {
+			if (*pte & PTE_SWAPPED) {
+				swap_decref(PTE_SLOT(*pte));
+			}
+			*pte = 0;
+			continue;
+		}
+		vaddrs[n] = vaddr;
+		oldptes[n] = *pte;
+		*pte = 0;
+		if (++n == TLBSHOOTDOWN_MAX) {
+			as_unmap_batch(as, vr, vaddrs, oldptes, n);
+			n = 0;
+		}
+	}
+	if (n > 0) {
+		as_unmap_batch(as, vr, vaddrs, oldptes, n);
+	}
+
+	lock_release(&as->as_lock);
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	struct vm_region *heap, *vr;
+	vaddr_t newbreak, oldtop, newtop;
+
+	heap = as->as_heap;
+	if (heap == NULL) {
+		return ENOSYS;
+	}
+
+	if (amount < 0 && (vaddr_t)-amount > as->as_heaptop - heap->vr_base) {
+		return EINVAL;
+	}
+	newbreak = as->as_heaptop + amount;
+	if (amount > 0 && (newbreak < as->as_heaptop ||
+			   newbreak > AS_STACKFLOOR(as))) {
+		return ENOMEM;
+	}
+
+	oldtop = heap->vr_base + heap->vr_npages * PAGE_SIZE;
+	newtop = (newbreak + PAGE_SIZE - 1) & PAGE_FRAME;
+
+	if (newtop > oldtop) {
+		/* Don't grow into anything, the stack in particular. */
+		for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+			if (vr != heap && vr->vr_base < newtop &&
+			    oldtop < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+				return ENOMEM;
+			}
+		}
+	}
+
+	heap->vr_npages = (newtop - heap->vr_base) / PAGE_SIZE;
+	if (newtop < oldtop) {
+		as_unmap(as, heap, newtop, (oldtop - newtop) / PAGE_SIZE);
+	}
+
+	*oldbreak = as->as_heaptop;
+	as->as_heaptop = newbreak;
+	return 0;
+}
+
+int
+as_mmap(struct addrspace *as, size_t len, int prot, int flags,
+	struct vnode *v, off_t offset, vaddr_t *ret)
+{
+	struct vm_region *vr;
+	vaddr_t base, top, floor;
+	size_t npages;
+	unsigned vrflags;
+
+	if (len == 0) {
+		return EINVAL;
+	}
+	switch (flags & (MAP_SHARED | MAP_PRIVATE)) {
+	    case MAP_SHARED:
+		vrflags = VR_MMAP | VR_SHARED;
+		break;
+	    case MAP_PRIVATE:
+		vrflags = VR_MMAP;
+		break;
+	    default:
+		return EINVAL;
+	}
+	vrflags |= ((prot & PROT_READ) ? VR_READ : 0) |
+		((prot & PROT_WRITE) ? VR_WRITE : 0) |
+		((prot & PROT_EXEC) ? VR_EXEC : 0);
+
+	if (len > USERSPACETOP) {
+		return ENOMEM;
+	}
+	npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+	/*
+	 * Find a gap, working down from the stack, but staying above
+	 * the heap's current top.
+	 */
+	floor = as->as_heap == NULL ? 0 :
+		as->as_heap->vr_base + as->as_heap->vr_npages * PAGE_SIZE;
+	top = AS_STACKFLOOR(as);
+	for (;;) {
+		if (top < floor + npages * PAGE_SIZE) {
+			return ENOMEM;
+		}
+		base = top - npages * PAGE_SIZE;
+		for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+			if (vr->vr_base < top &&
+			    base < vr->vr_base + vr->vr_npages * PAGE_SIZE) {
+				break;
+			}
+		}
+		if (vr == NULL) {
+			break;
+		}
+		top = vr->vr_base;
+	}
+
+	vr = as_newregion(as, base, npages, vrflags);
+	if (vr == NULL) {
+		return ENOMEM;
+	}
+	if (v != NULL) {
+		KASSERT(offset % PAGE_SIZE == 0);
+		VOP_INCOPEN(v);
+		VOP_INCREF(v);
+		vr->vr_vnode = v;
+		vr->vr_offset = offset;
+		vr->vr_fileva = base;
+		vr->vr_filesize = npages * PAGE_SIZE;
+	}
+
+	*ret = base;
+	return 0;
+}
+
+/*
+ * Write the page at VADDR of shared file mapping VR, in frame PA, to
+ * the file. Only the part up to EOF is written; pages past it read
+ * as zeros, and writing to them doesn't make the file any bigger.
+ */
+static
+int
+as_writepage(struct vm_region *vr, vaddr_t vaddr, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio ku;
+	struct stat st;
+	off_t offset;
+	size_t len;
+	int result;
+
+	result = VOP_STAT(vr->vr_vnode, &st);
+	if (result) {
+		return result;
+	}
+	offset = VR_FILEOFF(vr, vaddr);
+	if (offset >= st.st_size) {
+		return 0;
+	}
+	len = st.st_size - offset < PAGE_SIZE ?
+		st.st_size - offset : PAGE_SIZE;
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(pa), len, offset,
+		  UIO_WRITE);
+	return VOP_WRITE(vr->vr_vnode, &ku);
+}
+
+/*
+ * Write back VR's dirty pages, if it is a shared file mapping, a batch
+ * at a time. Each batch is marked clean and made read-only in the TLB
+ * before it is written, so a write that comes in meanwhile marks its
+ * page dirty again (in vm_fault) rather than getting lost. As in the
+ * fault path, as_lock isn't held across the file system calls, and
+ * the frames are held by a reference of their own rather than pinned,
+ * which they needn't be: dirty pages are never evicted.
+ */
+static
+int
+as_writeback(struct addrspace *as, struct vm_region *vr)
+{
+	vaddr_t vaddrs[TLBSHOOTDOWN_MAX];
+	paddr_t paddrs[TLBSHOOTDOWN_MAX];
+	vaddr_t vaddr, top;
+	unsigned i, n;
+	pte_t *pte;
+	int result, ret;
+
+	if (vr->vr_vnode == NULL || (vr->vr_flags & VR_SHARED) == 0) {
+		return 0;
+	}
+
+	ret = 0;
+	vaddr = vr->vr_base;
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+	while (vaddr < top) {
+		lock_acquire(&as->as_lock);
+		n = 0;
+		for (; vaddr < top && n < TLBSHOOTDOWN_MAX;
+		     vaddr += PAGE_SIZE) {
+			pte = pt_lookup(as->as_pt, vaddr, false);
+			if (pte == NULL || (*pte & PTE_DIRTY) == 0) {
+				continue;
+			}
+			paddrs[n] = coremap_pin(pte);
+			KASSERT(paddrs[n] != 0);
+			*pte &= ~(pte_t)PTE_DIRTY;
+			vaddrs[n++] = vaddr;
+		}
+		if (n > 0) {
+			as_tlbshootdown(as, vaddrs, n, true);
+		}
+		for (i = 0; i < n; i++) {
+			coremap_incref(paddrs[i]);
+			coremap_unbusy(paddrs[i]);
+		}
+		lock_release(&as->as_lock);
+
+		for (i = 0; i < n; i++) {
+			result = as_writepage(vr, vaddrs[i], paddrs[i]);
+			if (result && ret == 0) {
+				ret = result;
+			}
+			pagecache_release(paddrs[i]);
+		}
+	}
+	return ret;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t len)
+{
+	struct vm_region *vr, **prev;
+	int result;
+
+	for (prev = &as->as_regions; *prev != NULL; prev = &(*prev)->vr_next) {
+		if ((*prev)->vr_base == vaddr) {
+			break;
+		}
+	}
+	vr = *prev;
+	if (vr == NULL || (vr->vr_flags & VR_MMAP) == 0 ||
+	    (len + PAGE_SIZE - 1) / PAGE_SIZE != vr->vr_npages) {
+		return EINVAL;
+	}
+
+	/* As with close, the mapping goes even if writing back fails. */
+	result = as_writeback(as, vr);
+
+	*prev = vr->vr_next;
+	as_unmap(as, vr, vr->vr_base, vr->vr_npages);
+	if (vr->vr_vnode != NULL) {
+		vfs_close(vr->vr_vnode);
+	}
+	kfree(vr);
+	return result;
+}
+
+int
+as_sync(struct addrspace *as, struct vnode *v)
+{
+	struct vm_region *vr;
+	int result, ret;
+
+	ret = 0;
+	for (vr = as->as_regions; vr != NULL; vr = vr->vr_next) {
+		if (v == NULL || vr->vr_vnode == v) {
+			result = as_writeback(as, vr);
+			if (result && ret == 0) {
+				ret = result;
+			}
+		}
+	}
+	return ret;
+}
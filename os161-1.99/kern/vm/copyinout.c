@@ -84,8 +84,21 @@
  * To make use of this code, in addition to tm_badfaultfunc the
  * thread_machdep structure should contain a jmp_buf called
  * "tm_copyjmp".
+ *
+ * The copying itself is done here rather than with memcpy, a word at
+ * a time (four per loop for bigger copies) whenever the source and
+ * destination are equally aligned, and the string functions look for
+ * the terminating null a word at a time too. Since a page is a whole
+ * number of words, an aligned word load from a page the string
+ * reaches into can't fault where a byte load wouldn't.
+ *
+ * copyinv and copyoutv copy a batch of buffers, checking all of them
+ * first and setting up the fault recovery only once.
  */
 
+/* Nonzero if any byte of the 32-bit word W is zero. */
+#define HASZERO(w)	(((w) - 0x01010101U) & ~(w) & 0x80808080U)
+
 /*
  * Recovery function. If a fatal fault occurs during copyin, copyout,
  * copyinstr, or copyoutstr, execution resumes here. (This behavior is
@@ -142,11 +155,58 @@ copycheck(const_userptr_t userptr, size_t len, size_t *stoplen)
 	return 0;
 }
 
+/*
+ * Copy LEN bytes from SRC to DEST, which mustn't overlap. Like memcpy
+ * this is only safe on user addresses under the tm_badfaultfunc/
+ * copyfail logic, but it also moves words when the two addresses only
+ * line up after a few leading bytes or the length isn't a multiple of
+ * the word size.
+ */
+static
+void
+copymem(void *dest, const void *src, size_t len)
+{
+	char *d = dest;
+	const char *s = src;
+	uint32_t *dw;
+	const uint32_t *sw;
+
+	if (((uintptr_t)d ^ (uintptr_t)s) % sizeof(uint32_t) == 0) {
+		while ((uintptr_t)d % sizeof(uint32_t) != 0 && len > 0) {
+			*d++ = *s++;
+			len--;
+		}
+
+		dw = (uint32_t *)d;
+		sw = (const uint32_t *)s;
+		while (len >= 4 * sizeof(uint32_t)) {
+			dw[0] = sw[0];
+			dw[1] = sw[1];
+			dw[2] = sw[2];
+			dw[3] = sw[3];
+			dw += 4;
+			sw += 4;
+			len -= 4 * sizeof(uint32_t);
+		}
+		while (len >= sizeof(uint32_t)) {
+			*dw++ = *sw++;
+			len -= sizeof(uint32_t);
+		}
+		d = (char *)dw;
+		s = (const char *)sw;
+	}
+
+	while (len > 0) {
+		*d++ = *s++;
+		len--;
+	}
+}
+
 /*
  * copyin
  *
  * Copy a block of memory of length LEN from user-level address USERSRC 
- * to kernel address DEST. We can use memcpy because it's protected by
+ * to kernel address DEST. We can use copymem because it's protected by
  * the tm_badfaultfunc/copyfail logic.
  */
 int
@@ -172,7 +232,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy(dest, (const void *)usersrc, len);
+	copymem(dest, (const void *)usersrc, len);
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -182,7 +242,7 @@ copyin(const_userptr_t usersrc, void *dest, size_t len)
  * copyout
  *
  * Copy a block of memory of length LEN from kernel address SRC to
- * user-level address USERDEST. We can use memcpy because it's
+ * user-level address USERDEST. We can use copymem because it's
  * protected by the tm_badfaultfunc/copyfail logic.
  */
 int
@@ -208,7 +268,104 @@ copyout(const void *src, userptr_t userdest, size_t len)
 		return EFAULT;
 	}
 
-	memcpy((void *)userdest, src, len);
+	copymem((void *)userdest, src, len);
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * Check all NVEC buffers of a batch with copycheck. Every one has to
+ * fit entirely in userspace.
+ */
+static
+int
+copycheckv(const struct copyvec *vec, unsigned nvec)
+{
+	unsigned i;
+	size_t stoplen;
+	int result;
+
+	for (i=0; i<nvec; i++) {
+		if (vec[i].cv_len == 0) {
+			continue;
+		}
+		result = copycheck(vec[i].cv_uaddr, vec[i].cv_len, &stoplen);
+		if (result) {
+			return result;
+		}
+		if (stoplen != vec[i].cv_len) {
+			return EFAULT;
+		}
+	}
+	return 0;
+}
+
+/*
+ * copyinv
+ *
+ * Copy each of the NVEC user buffers in VEC into its kernel buffer.
+ * Nothing is copied unless all the user buffers are valid addresses;
+ * a fault partway through (on a page that isn't mapped after all)
+ * can still leave the earlier ones copied.
+ */
+int
+copyinv(const struct copyvec *vec, unsigned nvec)
+{
+	unsigned i;
+	int result;
+
+	result = copycheckv(vec, nvec);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	for (i=0; i<nvec; i++) {
+		copymem(vec[i].cv_kaddr, (const void *)vec[i].cv_uaddr,
+			vec[i].cv_len);
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = NULL;
+	return 0;
+}
+
+/*
+ * copyoutv
+ *
+ * Copy each of the NVEC kernel buffers in VEC out to its user buffer,
+ * as per copyinv.
+ */
+int
+copyoutv(const struct copyvec *vec, unsigned nvec)
+{
+	unsigned i;
+	int result;
+
+	result = copycheckv(vec, nvec);
+	if (result) {
+		return result;
+	}
+
+	curthread->t_machdep.tm_badfaultfunc = copyfail;
+
+	result = setjmp(curthread->t_machdep.tm_copyjmp);
+	if (result) {
+		curthread->t_machdep.tm_badfaultfunc = NULL;
+		return EFAULT;
+	}
+
+	for (i=0; i<nvec; i++) {
+		copymem((void *)vec[i].cv_uaddr, vec[i].cv_kaddr,
+			vec[i].cv_len);
+	}
 
 	curthread->t_machdep.tm_badfaultfunc = NULL;
 	return 0;
@@ -229,15 +386,45 @@ copyout(const void *src, userptr_t userdest, size_t len)
  * hit STOPLEN it's because the string has run into the end of
  * userspace. Thus in the latter case we return EFAULT, not 
  * ENAMETOOLONG.
+ *
+ * If SRC and DEST are equally aligned, whole words without a null in
+ * them are copied at once. A word is only stored if all of it fits,
+ * so DEST is never written past the end of the string.
  */
 static
 int
 copystr(char *dest, const char *src, size_t maxlen, size_t stoplen,
 	size_t *gotlen)
 {
-	size_t i;
+	size_t i, limit;
+	uint32_t w;
+
+	i = 0;
+	if (((uintptr_t)dest ^ (uintptr_t)src) % sizeof(uint32_t) == 0) {
+		limit = maxlen < stoplen ? maxlen : stoplen;
+		while ((uintptr_t)(src + i) % sizeof(uint32_t) != 0 &&
+		       i < limit) {
+			dest[i] = src[i];
+			if (src[i] == 0) {
+				if (gotlen != NULL) {
+					*gotlen = i+1;
+				}
+				return 0;
+			}
+			i++;
+		}
+		while (i + sizeof(uint32_t) <= limit) {
+			w = *(const uint32_t *)(src + i);
+			if (HASZERO(w)) {
+				/* the bytes loop below finds it */
+				break;
+			}
+			*(uint32_t *)(dest + i) = w;
+			i += sizeof(uint32_t);
+		}
+	}
 
-	for (i=0; i<maxlen && i<stoplen; i++) {
+	for (; i<maxlen && i<stoplen; i++) {
 		dest[i] = src[i];
 		if (src[i] == 0) {
 			if (gotlen != NULL) {
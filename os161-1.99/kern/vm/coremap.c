@@ -0,0 +1,865 @@
+/*
+ * Physical page frame allocator ("coremap").
+ *
+ * One struct coremap_entry describes each frame of the memory that
+ * ram_getsize() reports at vm_bootstrap time. Free memory is managed
+ * as a binary buddy system: a free block of order k is 2^k frames
+ * long and starts at a frame number (relative to the first frame in
+ * the coremap) that is a multiple of 2^k. There is one free list per
+ * order, threaded through the entries by frame number.
+ *
+ * Allocating NPAGES frames takes a block of the smallest order that
+ * fits, splitting a larger block if needed, and gives the unused
+ * tail back. Freeing a run breaks it into aligned blocks and merges
+ * each with its buddy for as long as the buddy is free. Both are
+ * O(log n) in the number of frames, apart from touching the entries
+ * of the frames themselves.
+ *
+ * The first frame of every allocated run records the length of the
+ * run, so coremap_free only needs the address that coremap_alloc gave
+ * out.
+ *
+ * Single frames, which is what almost everything asks for, normally
+ * don't touch the buddy system at all: each cpu keeps a small
+ * magazine of free frames in struct cpu. Its lock is only ever
+ * contended when a multi-page allocation fails and every magazine is
+ * drained. An empty magazine is refilled, and a full one partly
+ * spilled, CPU_PAGEMAG_BATCH frames at a time under coremap_lock.
+ * The magazine lock comes before coremap_lock.
+ * Frames sitting in a magazine are still marked CME_ALLOC as far as
+ * the buddy system is concerned. The magazines live in the OPT_A3
+ * part of struct cpu; without it (dumbvm), single frames come
+ * straight from the buddy system like everything else.
+ *
+ * Single frames also carry a reference count, so that user pages can
+ * be shared copy-on-write between address spaces after fork. A frame
+ * starts with one reference; coremap_decref frees it when the last
+ * one goes away.
+ *
+ * An unshared frame holding a user page is marked pageable, along
+ * with the address space and virtual address that map it, the next
+ * time it is loaded into the TLB. Those are the candidates for page
+ * replacement: coremap_clock_victim sweeps a clock hand over the
+ * coremap, giving each pageable frame whose reference bit is set a
+ * second chance. There is only room to remember one mapping, so a
+ * frame stops being pageable as soon as its reference count changes,
+ * until whoever still maps it touches it again.
+ *
+ * A frame marked CMF_BUSY belongs, along with the PTE that maps it,
+ * to whoever marked it: the pageout code, for a victim, or the owner
+ * of the address space, which pins a frame with coremap_pin while it
+ * works on the page. Page replacement takes no other lock, so that is
+ * what keeps it and the owner from changing the same PTE at once.
+ * Anyone who finds a frame busy in coremap_pin waits on cm_busywchan
+ * until it is unbusied (or freed).
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <spl.h>
+#include <wchan.h>
+#include <cpu.h>
+#include <current.h>
+#include <vm.h>
+#include <coremap.h>
+#include "opt-A3.h"
+
+/* Frame states */
+#define CME_FREE	0	/* part of a free buddy block */
+#define CME_FIXED	1	/* holds the coremap itself; never freed */
+#define CME_ALLOC	2	/* handed out by coremap_alloc */
+
+/* End-of-list marker for the free list links */
+#define CM_NONE		0xffffffff
+
+/* Largest buddy block is 2^CM_MAXORDER frames (16M with 4k pages). */
+#define CM_MAXORDER	12
+#define CM_NORDERS	(CM_MAXORDER + 1)
+
+struct coremap_entry {
+	uint32_t cme_state:2,		/* CME_* */
+		 cme_head:1,		/* first frame of a free block */
+		 cme_order:5,		/* order of the block, if cme_head */
+		 cme_npages:24;		/* run length, first frame only */
+	uint32_t cme_next;		/* free list links, by frame number */
+	uint32_t cme_prev;
+	struct addrspace *cme_as;	/* owner, if pageable */
+	vaddr_t cme_vaddr;		/* where cme_as maps it */
+	uint16_t cme_refcount;		/* user mappings of a single frame */
+	uint8_t cme_flags;		/* CMF_*, under coremap_lock */
+	uint8_t cme_ref;		/* clock reference bit; no lock */
+};
+
+/* Frame flags */
+#define CMF_PAGEABLE	0x01		/* user page; may be evicted */
+#define CMF_BUSY	0x02		/* victim, or pinned; hands off */
+
+static struct coremap_entry *coremap;
+static paddr_t cm_base;			/* physical address of frame 0 */
+static uint32_t cm_nframes;		/* number of entries in coremap */
+static uint32_t cm_nfree;		/* frames in free blocks */
+static uint32_t cm_freehead[CM_NORDERS]; /* free list per order */
+static uint32_t cm_nblocks[CM_NORDERS];	/* length of each free list */
+static uint32_t cm_hand;		/* clock hand for page replacement */
+static unsigned cm_nbusywait;		/* threads waiting in coremap_pin */
+static bool cm_ready = false;
+
+/*
+ * Protects everything above. A spinlock, because alloc_kpages is
+ * used in places that may not sleep.
+ */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+/* Where coremap_pin waits for a busy frame. */
+static struct wchan cm_busywchan;
+
+#define CM_PADDR(i)	(cm_base + (paddr_t)(i) * PAGE_SIZE)
+#define CM_INDEX(pa)	(((pa) - cm_base) / PAGE_SIZE)
+#define CM_BLOCK(k)	((uint32_t)1 << (k))
+
+////////////////////////////////////////////////////////////
+//
+// Free lists
+
+static
+void
+freelist_push(uint32_t i, unsigned order)
+{
+	struct coremap_entry *e = &coremap[i];
+
+	KASSERT(order <= CM_MAXORDER);
+	KASSERT(e->cme_state == CME_FREE);
+	KASSERT((i & (CM_BLOCK(order) - 1)) == 0);
+
+	e->cme_head = 1;
+	e->cme_order = order;
+	e->cme_prev = CM_NONE;
+	e->cme_next = cm_freehead[order];
+	if (cm_freehead[order] != CM_NONE) {
+		coremap[cm_freehead[order]].cme_prev = i;
+	}
+	cm_freehead[order] = i;
+	cm_nblocks[order]++;
+	cm_nfree += CM_BLOCK(order);
+}
+
+static
+void
+freelist_remove(uint32_t i)
+{
+	struct coremap_entry *e = &coremap[i];
+	unsigned order = e->cme_order;
+
+	KASSERT(e->cme_state == CME_FREE);
+	KASSERT(e->cme_head);
+	KASSERT(cm_nblocks[order] > 0);
+
+	if (e->cme_prev != CM_NONE) {
+		coremap[e->cme_prev].cme_next = e->cme_next;
+	}
+	else {
+		KASSERT(cm_freehead[order] == i);
+		cm_freehead[order] = e->cme_next;
+	}
+	if (e->cme_next != CM_NONE) {
+		coremap[e->cme_next].cme_prev = e->cme_prev;
+	}
+	e->cme_next = e->cme_prev = CM_NONE;
+	e->cme_head = 0;
+	cm_nblocks[order]--;
+	cm_nfree -= CM_BLOCK(order);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Buddy operations
+
+/*
+ * Put the free block of 2^ORDER frames at frame I back, merging it
+ * with its buddy as many times as possible. The frames must already
+ * be marked CME_FREE.
+ */
+static
+void
+buddy_insert(uint32_t i, unsigned order)
+{
+	uint32_t buddy;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	while (order < CM_MAXORDER) {
+		buddy = i ^ CM_BLOCK(order);
+		if (buddy + CM_BLOCK(order) > cm_nframes) {
+			break;
+		}
+		if (coremap[buddy].cme_state != CME_FREE ||
+		    !coremap[buddy].cme_head ||
+		    coremap[buddy].cme_order != order) {
+			break;
+		}
+		freelist_remove(buddy);
+		if (buddy < i) {
+			coremap[i].cme_head = 0;
+			i = buddy;
+		}
+		order++;
+	}
+	freelist_push(i, order);
+}
+
+/*
+ * Release NPAGES frames starting at frame START, which need not be a
+ * buddy block: it is carved into the largest aligned blocks that fit.
+ */
+static
+void
+buddy_free_range(uint32_t start, uint32_t npages)
+{
+	uint32_t i;
+	unsigned order;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (i = start; i < start + npages; i++) {
+		coremap[i].cme_state = CME_FREE;
+		coremap[i].cme_head = 0;
+		coremap[i].cme_npages = 0;
+	}
+
+	while (npages > 0) {
+		order = 0;
+		while (order < CM_MAXORDER &&
+		       (start & (CM_BLOCK(order + 1) - 1)) == 0 &&
+		       CM_BLOCK(order + 1) <= npages) {
+			order++;
+		}
+		buddy_insert(start, order);
+		start += CM_BLOCK(order);
+		npages -= CM_BLOCK(order);
+	}
+}
+
+/*
+ * Take a free block of exactly 2^ORDER frames, splitting a bigger one
+ * if necessary. Returns its first frame, or CM_NONE.
+ */
+static
+uint32_t
+buddy_take(unsigned order)
+{
+	unsigned k;
+	uint32_t i;
+
+	KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+	for (k = order; k <= CM_MAXORDER; k++) {
+		if (cm_freehead[k] != CM_NONE) {
+			break;
+		}
+	}
+	if (k > CM_MAXORDER) {
+		return CM_NONE;
+	}
+
+	i = cm_freehead[k];
+	freelist_remove(i);
+
+	/* Hand the upper halves back until the block is the right size. */
+	while (k > order) {
+		k--;
+		freelist_push(i + CM_BLOCK(k), k);
+	}
+	return i;
+}
+
+#if OPT_A3
+////////////////////////////////////////////////////////////
+//
+// Per-cpu magazines
+
+/*
+ * Move up to CPU_PAGEMAG_BATCH single frames from the buddy system
+ * into C's magazine. Caller holds C's magazine lock.
+ */
+static
+void
+pagemag_refill(struct cpu *c)
+{
+	uint32_t i;
+
+	KASSERT(spinlock_do_i_hold(&c->c_pagemag_lock));
+
+	spinlock_acquire(&coremap_lock);
+	while (c->c_pagemag_count < CPU_PAGEMAG_BATCH) {
+		i = buddy_take(0);
+		if (i == CM_NONE) {
+			break;
+		}
+		coremap[i].cme_state = CME_ALLOC;
+		coremap[i].cme_npages = 1;
+		c->c_pagemag[c->c_pagemag_count++] = CM_PADDR(i);
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Give the oldest N frames in C's magazine back to the buddy system.
+ * Caller holds C's magazine lock.
+ */
+static
+void
+pagemag_spill(struct cpu *c, unsigned n)
+{
+	unsigned j;
+
+	KASSERT(spinlock_do_i_hold(&c->c_pagemag_lock));
+	KASSERT(n <= c->c_pagemag_count);
+
+	spinlock_acquire(&coremap_lock);
+	for (j = 0; j < n; j++) {
+		buddy_free_range(CM_INDEX(c->c_pagemag[j]), 1);
+	}
+	spinlock_release(&coremap_lock);
+
+	for (j = n; j < c->c_pagemag_count; j++) {
+		c->c_pagemag[j - n] = c->c_pagemag[j];
+	}
+	c->c_pagemag_count -= n;
+}
+
+static
+paddr_t
+pagemag_get(void)
+{
+	struct cpu *c;
+	paddr_t pa;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_pagemag_lock);
+	if (c->c_pagemag_count == 0) {
+		pagemag_refill(c);
+	}
+	if (c->c_pagemag_count > 0) {
+		pa = c->c_pagemag[--c->c_pagemag_count];
+		/* ours now; no one else can be looking at the entry */
+		coremap[CM_INDEX(pa)].cme_refcount = 1;
+		coremap[CM_INDEX(pa)].cme_flags = 0;
+		coremap[CM_INDEX(pa)].cme_as = NULL;
+	}
+	else {
+		pa = 0;
+	}
+	spinlock_release(&c->c_pagemag_lock);
+	splx(spl);
+	return pa;
+}
+
+static
+void
+pagemag_put(paddr_t pa)
+{
+	struct cpu *c;
+	int spl;
+
+	spl = splhigh();
+	c = curcpu->c_self;
+	spinlock_acquire(&c->c_pagemag_lock);
+	if (c->c_pagemag_count == CPU_PAGEMAG_SIZE) {
+		pagemag_spill(c, CPU_PAGEMAG_BATCH);
+	}
+	c->c_pagemag[c->c_pagemag_count++] = pa;
+	spinlock_release(&c->c_pagemag_lock);
+	splx(spl);
+}
+
+/*
+ * Empty every cpu's magazine, so their frames can be merged back into
+ * bigger blocks. Used when a multi-page allocation fails.
+ */
+static
+void
+pagemag_drain(void)
+{
+	struct cpu *c;
+	unsigned n;
+
+	for (n = 0; (c = cpu_bynumber(n)) != NULL; n++) {
+		spinlock_acquire(&c->c_pagemag_lock);
+		pagemag_spill(c, c->c_pagemag_count);
+		spinlock_release(&c->c_pagemag_lock);
+	}
+}
+#endif /* OPT_A3 */
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+void
+coremap_bootstrap(void)
+{
+	paddr_t lo, hi;
+	size_t cmsize;
+	uint32_t i, nfixed;
+	unsigned k;
+
+	KASSERT(!cm_ready);
+
+	ram_getsize(&lo, &hi);
+	KASSERT((lo & PAGE_FRAME) == lo);
+	KASSERT((hi & PAGE_FRAME) == hi);
+	KASSERT(hi > lo);
+
+	cm_base = lo;
+	cm_nframes = (hi - lo) / PAGE_SIZE;
+
+	/* The coremap itself goes in the first frames of the range. */
+	cmsize = cm_nframes * sizeof(struct coremap_entry);
+	nfixed = (cmsize + PAGE_SIZE - 1) / PAGE_SIZE;
+	KASSERT(nfixed < cm_nframes);
+
+	coremap = (struct coremap_entry *)PADDR_TO_KVADDR(lo);
+
+	for (k = 0; k < CM_NORDERS; k++) {
+		cm_freehead[k] = CM_NONE;
+		cm_nblocks[k] = 0;
+	}
+	cm_nfree = 0;
+
+	for (i = 0; i < nfixed; i++) {
+		coremap[i].cme_state = CME_FIXED;
+		coremap[i].cme_head = 0;
+		coremap[i].cme_order = 0;
+		coremap[i].cme_npages = 0;
+		coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_flags = 0;
+		coremap[i].cme_ref = 0;
+	}
+	for (i = nfixed; i < cm_nframes; i++) {
+		coremap[i].cme_order = 0;
+		coremap[i].cme_next = coremap[i].cme_prev = CM_NONE;
+		coremap[i].cme_refcount = 0;
+		coremap[i].cme_as = NULL;
+		coremap[i].cme_vaddr = 0;
+		coremap[i].cme_flags = 0;
+		coremap[i].cme_ref = 0;
+	}
+
+	wchan_init(&cm_busywchan, "coremap");
+
+	spinlock_acquire(&coremap_lock);
+	buddy_free_range(nfixed, cm_nframes - nfixed);
+	cm_hand = nfixed;
+	cm_nbusywait = 0;
+	cm_ready = true;
+	spinlock_release(&coremap_lock);
+
+	kprintf("coremap: %u frames, %u free\n", cm_nframes, cm_nfree);
+}
+
+/*
+ * Allocate NPAGES contiguous frames from the buddy system.
+ */
+static
+paddr_t
+coremap_alloc_run(unsigned long npages)
+{
+	uint32_t i, start;
+	unsigned order;
+
+	order = 0;
+	while (order <= CM_MAXORDER && CM_BLOCK(order) < npages) {
+		order++;
+	}
+	if (order > CM_MAXORDER) {
+		return 0;
+	}
+
+	spinlock_acquire(&coremap_lock);
+
+	if (npages > cm_nfree) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	start = buddy_take(order);
+	if (start == CM_NONE) {
+		spinlock_release(&coremap_lock);
+		return 0;
+	}
+
+	for (i = start; i < start + npages; i++) {
+		coremap[i].cme_state = CME_ALLOC;
+		coremap[i].cme_head = 0;
+		coremap[i].cme_npages = 0;
+	}
+	coremap[start].cme_npages = npages;
+	coremap[start].cme_refcount = 1;
+	coremap[start].cme_flags = 0;
+	coremap[start].cme_as = NULL;
+
+	/* Give back the part of the block we don't need. */
+	if (npages < CM_BLOCK(order)) {
+		buddy_free_range(start + npages, CM_BLOCK(order) - npages);
+	}
+
+	spinlock_release(&coremap_lock);
+
+	return CM_PADDR(start);
+}
+
+paddr_t
+coremap_alloc(unsigned long npages)
+{
+	paddr_t pa;
+
+	KASSERT(npages > 0);
+
+	if (!cm_ready) {
+		/* Too early; carve it off the front of memory for good. */
+		spinlock_acquire(&coremap_lock);
+		pa = ram_stealmem(npages);
+		spinlock_release(&coremap_lock);
+		return pa;
+	}
+
+#if OPT_A3
+	if (npages == 1) {
+		return pagemag_get();
+	}
+#endif
+
+	pa = coremap_alloc_run(npages);
+#if OPT_A3
+	if (pa == 0) {
+		/* Cached frames may be what's keeping blocks apart. */
+		pagemag_drain();
+		pa = coremap_alloc_run(npages);
+	}
+#endif
+	return pa;
+}
+
+void
+coremap_free(paddr_t pa)
+{
+	uint32_t i, start, npages;
+
+	KASSERT((pa & PAGE_FRAME) == pa);
+
+	if (!cm_ready || pa < cm_base) {
+		/* Came from ram_stealmem before the coremap existed. */
+		return;
+	}
+
+	start = CM_INDEX(pa);
+	KASSERT(start < cm_nframes);
+
+	/*
+	 * The caller owns the frame, so nobody else is changing its
+	 * entry and we can look at it without the lock.
+	 */
+	if (coremap[start].cme_state != CME_ALLOC ||
+	    coremap[start].cme_npages == 0) {
+		panic("coremap_free: 0x%x is not an allocated run\n", pa);
+	}
+
+	npages = coremap[start].cme_npages;
+#if OPT_A3
+	if (npages == 1) {
+		pagemag_put(pa);
+		return;
+	}
+#endif
+
+	spinlock_acquire(&coremap_lock);
+
+	for (i = start; i < start + npages; i++) {
+		KASSERT(coremap[i].cme_state == CME_ALLOC);
+	}
+	buddy_free_range(start, npages);
+
+	spinlock_release(&coremap_lock);
+}
+
+void
+coremap_incref(paddr_t pa)
+{
+	struct coremap_entry *e;
+
+	KASSERT(cm_ready && pa >= cm_base);
+
+	spinlock_acquire(&coremap_lock);
+	e = &coremap[CM_INDEX(pa)];
+	KASSERT(e->cme_state == CME_ALLOC && e->cme_npages == 1);
+	KASSERT(e->cme_refcount > 0 && e->cme_refcount < 0xffff);
+	e->cme_refcount++;
+	e->cme_flags &= ~CMF_PAGEABLE;
+	e->cme_as = NULL;
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Drop a reference. If the frame is busy and this was the last one,
+ * it was busy for the caller, who is done with it; otherwise it stays
+ * busy for whoever has it. If UNBUSY is set the caller has it busy,
+ * and it stops being busy either way.
+ */
+static
+void
+coremap_drop(paddr_t pa, bool unbusy)
+{
+	struct coremap_entry *e;
+	unsigned refs;
+	bool wake;
+
+	KASSERT(cm_ready && pa >= cm_base);
+
+	spinlock_acquire(&coremap_lock);
+	e = &coremap[CM_INDEX(pa)];
+	KASSERT(e->cme_state == CME_ALLOC && e->cme_npages == 1);
+	KASSERT(e->cme_refcount > 0);
+	KASSERT(!unbusy || (e->cme_flags & CMF_BUSY));
+	refs = --e->cme_refcount;
+	wake = false;
+	if (refs == 0 || unbusy) {
+		wake = (e->cme_flags & CMF_BUSY) && cm_nbusywait > 0;
+		e->cme_flags = 0;
+	}
+	else {
+		/* whoever's left, it isn't necessarily the recorded owner */
+		e->cme_flags &= CMF_BUSY;
+	}
+	e->cme_as = NULL;
+	spinlock_release(&coremap_lock);
+
+	if (wake) {
+		wchan_wakeall(&cm_busywchan);
+	}
+	if (refs == 0) {
+		/* that was the last mapping, so nobody can incref it now */
+		coremap_free(pa);
+	}
+}
+
+void
+coremap_decref(paddr_t pa)
+{
+	coremap_drop(pa, false);
+}
+
+void
+coremap_decref_busy(paddr_t pa)
+{
+	coremap_drop(pa, true);
+}
+
+unsigned
+coremap_refcount(paddr_t pa)
+{
+	unsigned refs;
+
+	KASSERT(cm_ready && pa >= cm_base);
+
+	spinlock_acquire(&coremap_lock);
+	refs = coremap[CM_INDEX(pa)].cme_refcount;
+	spinlock_release(&coremap_lock);
+	return refs;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Page replacement
+
+/*
+ * Called on every TLB load of a user page that AS maps at VADDR. If
+ * the frame isn't shared, that's its owner, and it becomes pageable.
+ * The reference bit is only ever cleared by the clock hand, so setting
+ * it doesn't need the lock.
+ */
+void
+coremap_touch(paddr_t pa, struct addrspace *as, vaddr_t vaddr)
+{
+	struct coremap_entry *e;
+
+	KASSERT(cm_ready && pa >= cm_base);
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	e = &coremap[CM_INDEX(pa)];
+	e->cme_ref = 1;
+	if (e->cme_flags & CMF_PAGEABLE) {
+		return;
+	}
+
+	spinlock_acquire(&coremap_lock);
+	KASSERT(e->cme_state == CME_ALLOC && e->cme_npages == 1);
+	if (e->cme_refcount == 1) {
+		e->cme_as = as;
+		e->cme_vaddr = vaddr;
+		e->cme_flags |= CMF_PAGEABLE;
+	}
+	spinlock_release(&coremap_lock);
+}
+
+/*
+ * Advance the clock hand to the next pageable, unshared frame whose
+ * reference bit is clear, clearing the bits of the ones passed over.
+ * Two full turns are enough to find one if there is one at all.
+ *
+ * The victim is marked CMF_BUSY and its owner returned; the caller
+ * either evicts it (which frees the frame) or calls coremap_unbusy.
+ */
+paddr_t
+coremap_clock_victim(struct addrspace **asp, vaddr_t *vaddrp)
+{
+	struct coremap_entry *e;
+	uint32_t n, i;
+
+	KASSERT(cm_ready);
+
+	spinlock_acquire(&coremap_lock);
+	for (n = 0; n < 2 * cm_nframes; n++) {
+		i = cm_hand;
+		cm_hand = (cm_hand + 1) % cm_nframes;
+
+		e = &coremap[i];
+		if (e->cme_state != CME_ALLOC ||
+		    (e->cme_flags & (CMF_PAGEABLE|CMF_BUSY)) != CMF_PAGEABLE ||
+		    e->cme_refcount != 1) {
+			continue;
+		}
+		if (e->cme_ref) {
+			e->cme_ref = 0;
+			continue;
+		}
+
+		e->cme_flags |= CMF_BUSY;
+		*asp = e->cme_as;
+		*vaddrp = e->cme_vaddr;
+		spinlock_release(&coremap_lock);
+		return CM_PADDR(i);
+	}
+	spinlock_release(&coremap_lock);
+	return 0;
+}
+
+/*
+ * The PTE is read under coremap_lock. Whoever has the frame busy
+ * changes the PTE before unbusying or freeing the frame, which also
+ * takes coremap_lock, so once the frame is seen not busy the PTE is
+ * up to date. The owner is the only one who points a PTE at a frame,
+ * and it holds the address space's lock, so a frame a PTE maps is
+ * never a stale one that has since gone to someone else.
+ */
+paddr_t
+coremap_pin(const pte_t *pte)
+{
+	struct coremap_entry *e;
+	pte_t val;
+
+	KASSERT(cm_ready);
+
+	spinlock_acquire(&coremap_lock);
+	while (1) {
+		val = *pte;
+		if ((val & PTE_VALID) == 0) {
+			spinlock_release(&coremap_lock);
+			return 0;
+		}
+		e = &coremap[CM_INDEX(val & PTE_FRAME)];
+		KASSERT(e->cme_state == CME_ALLOC && e->cme_npages == 1);
+		if ((e->cme_flags & CMF_BUSY) == 0) {
+			break;
+		}
+		cm_nbusywait++;
+		wchan_lock(&cm_busywchan);
+		spinlock_release(&coremap_lock);
+		wchan_sleep(&cm_busywchan);
+		spinlock_acquire(&coremap_lock);
+		cm_nbusywait--;
+	}
+	e->cme_flags |= CMF_BUSY;
+	spinlock_release(&coremap_lock);
+	return val & PTE_FRAME;
+}
+
+bool
+coremap_busy(paddr_t pa)
+{
+	bool busy;
+
+	KASSERT(cm_ready && pa >= cm_base);
+
+	spinlock_acquire(&coremap_lock);
+	busy = (coremap[CM_INDEX(pa)].cme_flags & CMF_BUSY) != 0;
+	spinlock_release(&coremap_lock);
+	return busy;
+}
+
+void
+coremap_unbusy(paddr_t pa)
+{
+	struct coremap_entry *e;
+	bool wake;
+
+	KASSERT(cm_ready && pa >= cm_base);
+
+	spinlock_acquire(&coremap_lock);
+	e = &coremap[CM_INDEX(pa)];
+	KASSERT(e->cme_flags & CMF_BUSY);
+	e->cme_flags &= ~CMF_BUSY;
+	wake = cm_nbusywait > 0;
+	spinlock_release(&coremap_lock);
+
+	if (wake) {
+		wchan_wakeall(&cm_busywchan);
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Statistics
+
+/*
+ * Frames cached in per-cpu magazines are not counted.
+ */
+unsigned long
+coremap_freecount(void)
+{
+	unsigned long n;
+
+	spinlock_acquire(&coremap_lock);
+	n = cm_nfree;
+	spinlock_release(&coremap_lock);
+	return n;
+}
+
+void
+coremap_printstats(void)
+{
+	uint32_t counts[CM_NORDERS];
+	uint32_t nfree, nframes;
+	unsigned k;
+
+	/* copy under the lock; kprintf may sleep */
+	spinlock_acquire(&coremap_lock);
+	for (k = 0; k < CM_NORDERS; k++) {
+		counts[k] = cm_nblocks[k];
+	}
+	nfree = cm_nfree;
+	nframes = cm_nframes;
+	spinlock_release(&coremap_lock);
+
+	kprintf("Coremap buddy allocator: %u/%u frames free\n",
+		nfree, nframes);
+	for (k = 0; k < CM_NORDERS; k++) {
+		kprintf("   order %2u (%5u pages): %u free\n",
+			k, CM_BLOCK(k), counts[k]);
+	}
+}
@@ -29,8 +29,15 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include "opt-kmallocprof.h"
+#if OPT_KMALLOCPROF
+#include <clock.h>
+#endif
 
 /*
  * Kernel malloc.
@@ -75,6 +82,18 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    The table is hashed by page address, so kfree can get from a
+//    pointer to its page (and so its block size) without looking at
+//    any other page.
+//
+//    In front of the pages, each cpu keeps a magazine of free blocks
+//    of each size (c_kmag in struct cpu), which only it touches, with
+//    interrupts off. kmalloc takes from it and kfree puts back into
+//    it without taking the allocator's spinlock. An empty magazine is
+//    refilled with CPU_KMAG_BATCH blocks under one acquisition of the
+//    lock, and a full one gives that many back to their pages. As far
+//    as the pages are concerned, blocks in magazines are allocated.
+//
 
 #undef  SLOW	/* consistency checks */
 #undef SLOWER	/* lots of consistency checks */
@@ -89,6 +108,10 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #define SMALLEST_SUBPAGE_SIZE 16
 #define LARGEST_SUBPAGE_SIZE 2048
 
+#if NSIZES != CPU_KMAG_NSIZES
+#error "CPU_KMAG_NSIZES doesn't match the number of block sizes"
+#endif
+
 #elif PAGE_SIZE == 8192
 #error "No support for 8k pages (yet?)"
 #else
@@ -103,7 +126,7 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
-	struct pageref *next_all;
+	struct pageref *next_hash;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -184,19 +207,37 @@ freepageref(struct pageref *p)
 ////////////////////////////////////////
 
 static struct pageref *sizebases[NSIZES];
-static struct pageref *allbase;
+
+/*
+ * All the pages, hashed by address. Kernel pages are mostly
+ * consecutive, so one chain per pageref keeps the chains short.
+ */
+static struct pageref *pagehash[NPAGEREFS];
+
+#define PR_HASH(pageaddr) (((pageaddr) / PAGE_SIZE) % NPAGEREFS)
 
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * Use one spinlock for the page lists. The per-cpu magazines keep
+ * most allocations and frees from needing it.
+ *
+ * kfree only needs to find the page a block is on, so the hash chains
+ * also have locks of their own, each shared by every PR_NHASHLOCKS'th
+ * chain. Changing a chain takes both kmalloc_spinlock and the chain's
+ * lock, in that order, so looking one up takes either.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
+#define PR_NHASHLOCKS 16
+#define PR_HASHLOCK(pageaddr) \
+	(&pagehash_locks[PR_HASH(pageaddr) % PR_NHASHLOCKS])
+
+static struct spinlock pagehash_locks[PR_NHASHLOCKS] = {
+	[0 ... PR_NHASHLOCKS-1] = SPINLOCK_INITIALIZER
+};
+
 ////////////////////////////////////////
 
 /* SLOWER implies SLOW */
@@ -252,7 +293,7 @@ void
 checksubpages(void)
 {
 	struct pageref *pr;
-	int i;
+	unsigned i;
 	unsigned sc=0, ac=0;
 
 	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
@@ -265,10 +306,13 @@ checksubpages(void)
 		}
 	}
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
-		ac++;
+	for (i=0; i<NPAGEREFS; i++) {
+		for (pr = pagehash[i]; pr != NULL; pr = pr->next_hash) {
+			checksubpage(pr);
+			KASSERT(PR_HASH(PR_PAGEADDR(pr)) == i);
+			KASSERT(ac < NPAGEREFS);
+			ac++;
+		}
 	}
 
 	KASSERT(sc==ac);
@@ -334,14 +378,17 @@ void
 kheap_printstats(void)
 {
 	struct pageref *pr;
+	unsigned i;
 
 	/* print the whole thing with interrupts off */
 	spinlock_acquire(&kmalloc_spinlock);
 
 	kprintf("Subpage allocator status:\n");
 
-	for (pr = allbase; pr != NULL; pr = pr->next_all) {
-		dumpsubpage(pr);
+	for (i=0; i<NPAGEREFS; i++) {
+		for (pr = pagehash[i]; pr != NULL; pr = pr->next_hash) {
+			dumpsubpage(pr);
+		}
 	}
 
 	spinlock_release(&kmalloc_spinlock);
@@ -365,13 +412,16 @@ remove_lists(struct pageref *pr, int blktype)
 		}
 	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
+	spinlock_acquire(PR_HASHLOCK(PR_PAGEADDR(pr)));
+	for (guy = &pagehash[PR_HASH(PR_PAGEADDR(pr))]; *guy;
+	     guy = &(*guy)->next_hash) {
 		checksubpage(*guy);
 		if (*guy == pr) {
-			*guy = pr->next_all;
+			*guy = pr->next_hash;
 			break;
 		}
 	}
+	spinlock_release(PR_HASHLOCK(PR_PAGEADDR(pr)));
 }
 
 static
@@ -392,6 +442,183 @@ int blocktype(size_t sz)
 	return 0;
 }
 
+/*
+ * Take a block off the freelist of PR, which must have one.
+ */
+static
+void *
+subpage_getblock(struct pageref *pr)
+{
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	void *retptr;		// our result
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+	KASSERT(pr->nfree > 0);
+	KASSERT(pr->freelist_offset < PAGE_SIZE);
+
+	prpage = PR_PAGEADDR(pr);
+	fla = prpage + pr->freelist_offset;
+	fl = (struct freelist *)fla;
+
+	retptr = fl;
+	fl = fl->next;
+	pr->nfree--;
+
+	if (fl != NULL) {
+		KASSERT(pr->nfree > 0);
+		fla = (vaddr_t)fl;
+		KASSERT(fla - prpage < PAGE_SIZE);
+		pr->freelist_offset = fla - prpage;
+	}
+	else {
+		KASSERT(pr->nfree == 0);
+		pr->freelist_offset = INVALID_OFFSET;
+	}
+
+	return retptr;
+}
+
+/*
+ * Put the block at PTRADDR back on the freelist of its page PR. If
+ * that makes the whole page free, take it off the lists, free its
+ * pageref, and return its address so the caller can free it once it
+ * has let go of the spinlock. Otherwise return 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+
+	fl = (struct freelist *)ptraddr;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		remove_lists(pr, blktype);
+		freepageref(pr);
+		return prpage;
+	}
+	return 0;
+}
+
+/*
+ * Find the page the block at PTRADDR belongs to, or NULL if it isn't
+ * a subpage allocation. Only looks at the one hash chain the page
+ * would be on, however big the heap is. The caller holds either
+ * kmalloc_spinlock or that chain's lock.
+ */
+static
+struct pageref *
+subpage_findpage(vaddr_t ptraddr)
+{
+	struct pageref *pr;	// pageref for page we're freeing in
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+
+	prpage = ptraddr & PAGE_FRAME;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock) ||
+		spinlock_do_i_hold(PR_HASHLOCK(prpage)));
+
+	for (pr = pagehash[PR_HASH(prpage)]; pr; pr = pr->next_hash) {
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr) < NSIZES);
+
+		if (PR_PAGEADDR(pr) == prpage) {
+			return pr;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Fill cpu C's magazine for BLKTYPE with up to CPU_KMAG_BATCH blocks
+ * from pages that have some free. Doesn't get new pages; if there
+ * aren't any free blocks, subpage_kmalloc takes the slow path.
+ */
+static
+void
+kmag_refill(struct cpu *c, unsigned blktype)
+{
+	struct pageref *pr;
+	unsigned n;
+
+	KASSERT(curthread->t_curspl > 0);
+
+	n = c->c_kmag_count[blktype];
+	spinlock_acquire(&kmalloc_spinlock);
+	for (pr = sizebases[blktype];
+	     pr != NULL && n < CPU_KMAG_BATCH;
+	     pr = pr->next_samesize) {
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		checksubpage(pr);
+		while (pr->nfree > 0 && n < CPU_KMAG_BATCH) {
+			c->c_kmag[blktype][n++] = subpage_getblock(pr);
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+	c->c_kmag_count[blktype] = n;
+}
+
+/*
+ * Give the N oldest blocks in cpu C's magazine for BLKTYPE back to
+ * their pages, freeing any pages that leaves empty.
+ */
+static
+void
+kmag_spill(struct cpu *c, unsigned blktype, unsigned n)
+{
+	vaddr_t freepages[CPU_KMAG_SIZE];
+	struct pageref *pr;
+	vaddr_t ptraddr;
+	unsigned i, nfreepages;
+
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(n <= c->c_kmag_count[blktype]);
+
+	nfreepages = 0;
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<n; i++) {
+		ptraddr = (vaddr_t)c->c_kmag[blktype][i];
+		pr = subpage_findpage(ptraddr);
+		KASSERT(pr != NULL);
+		KASSERT(PR_BLOCKTYPE(pr) == blktype);
+		freepages[nfreepages] = subpage_putblock(pr, ptraddr);
+		if (freepages[nfreepages] != 0) {
+			nfreepages++;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+
+	for (i=n; i<c->c_kmag_count[blktype]; i++) {
+		c->c_kmag[blktype][i - n] = c->c_kmag[blktype][i];
+	}
+	c->c_kmag_count[blktype] -= n;
+}
+
 static
 void *
 subpage_kmalloc(size_t sz)
@@ -402,6 +629,8 @@ subpage_kmalloc(size_t sz)
 	vaddr_t fla;		// free list entry address
 	struct freelist *volatile fl;	// free list entry
 	void *retptr;		// our result
+	struct cpu *c;
+	int spl;
 
 	volatile int i;
 
@@ -409,6 +638,21 @@ subpage_kmalloc(size_t sz)
 	blktype = blocktype(sz);
 	sz = sizes[blktype];
 
+	/* Fast path: this cpu's magazine. (Not before there's a curcpu.) */
+	if (CURCPU_EXISTS()) {
+		spl = splhigh();
+		c = curcpu->c_self;
+		if (c->c_kmag_count[blktype] == 0) {
+			kmag_refill(c, blktype);
+		}
+		if (c->c_kmag_count[blktype] > 0) {
+			retptr = c->c_kmag[blktype][--c->c_kmag_count[blktype]];
+			splx(spl);
+			return retptr;
+		}
+		splx(spl);
+	}
+
 	spinlock_acquire(&kmalloc_spinlock);
 
 	checksubpages();
@@ -423,25 +667,7 @@ subpage_kmalloc(size_t sz)
 
 		doalloc: /* comes here after getting a whole fresh page */
 
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
-
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
-
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+			retptr = subpage_getblock(pr);
 
 			checksubpages();
 
@@ -501,8 +727,10 @@ subpage_kmalloc(size_t sz)
 	pr->next_samesize = sizebases[blktype];
 	sizebases[blktype] = pr;
 
-	pr->next_all = allbase;
-	allbase = pr;
+	spinlock_acquire(PR_HASHLOCK(prpage));
+	pr->next_hash = pagehash[PR_HASH(prpage)];
+	pagehash[PR_HASH(prpage)] = pr;
+	spinlock_release(PR_HASHLOCK(prpage));
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -516,35 +744,27 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
+	struct cpu *c;
+	int spl;
 
 	ptraddr = (vaddr_t)ptr;
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	/*
+	 * Only the chain's lock. Once found, the page and its block
+	 * type can't change under us: as far as it knows, the block is
+	 * still in use.
+	 */
+	spinlock_acquire(PR_HASHLOCK(ptraddr & PAGE_FRAME));
+	pr = subpage_findpage(ptraddr);
+	spinlock_release(PR_HASHLOCK(ptraddr & PAGE_FRAME));
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -563,28 +783,25 @@ subpage_kfree(void *ptr)
 	 * is already on the free list. But that's expensive, so we don't.
 	 */
 
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+	if (CURCPU_EXISTS()) {
+		/* Into this cpu's magazine. */
+		spl = splhigh();
+		c = curcpu->c_self;
+		if (c->c_kmag_count[blktype] == CPU_KMAG_SIZE) {
+			kmag_spill(c, blktype, CPU_KMAG_BATCH);
+		}
+		c->c_kmag[blktype][c->c_kmag_count[blktype]++] = ptr;
+		splx(spl);
+		return 0;
 	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
 
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
+	spinlock_acquire(&kmalloc_spinlock);
+	prpage = subpage_putblock(pr, ptraddr);
+	spinlock_release(&kmalloc_spinlock);
+	if (prpage != 0) {
 		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
 
 #ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
@@ -595,12 +812,329 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+#if OPT_KMALLOCPROF
+////////////////////////////////////////////////////////////
+//
+// Allocation profiler.
+//
+//    Every live allocation is remembered in a kprof_block, hashed by
+//    address, with its call site (the return address of its call to
+//    kmalloc) and the size it really took up. Each call site has a
+//    kprof_site, found by hashing the return address, that counts its
+//    allocations and live bytes and keeps its high-water mark.
+//
+//    The tables can't come from kmalloc, so they are fixed-size, in
+//    the BSS. Allocations that don't fit are counted as untracked;
+//    frees of blocks that weren't tracked are ignored.
+//
+//    Wrappers around kmalloc (kstrdup, kmem_cache_alloc) call
+//    kmalloc_at with their own caller's return address, so their
+//    allocations are charged to whoever called the wrapper.
+//
+
+#define KPROF_NSITES	256	/* must be a power of 2 */
+#define KPROF_NBLOCKS	2048
+#define KPROF_BUCKETBITS	9
+#define KPROF_NBUCKETS	(1 << KPROF_BUCKETBITS)
+
+/* Size class used for allocations of whole pages */
+#define KPROF_PAGES	NSIZES
+
+#define KPROF_SITEHASH(site) (((site) >> 2) & (KPROF_NSITES - 1))
+/*
+ * Blocks of one size class are spaced evenly, a power of 2 apart, so
+ * the low bits of their addresses alone would pile them up on a few
+ * chains. Multiplying by 2^32/phi mixes all the bits into the top ones.
+ */
+#define KPROF_BLOCKHASH(addr) \
+	(((uint32_t)((addr) >> 4) * 2654435761U) >> (32 - KPROF_BUCKETBITS))
+
+struct kprof_site {
+	vaddr_t ks_site;		/* return address; 0 if slot unused */
+	uint32_t ks_classes;		/* bit per size class allocated */
+	unsigned ks_nallocs;		/* total allocations */
+	unsigned ks_lastnallocs;	/* ks_nallocs at the last dump */
+	unsigned ks_nlive;		/* allocations not yet freed */
+	size_t ks_livebytes;		/* bytes not yet freed */
+	size_t ks_maxbytes;		/* high-water mark of ks_livebytes */
+};
+
+struct kprof_block {
+	vaddr_t kb_addr;
+	struct kprof_site *kb_site;
+	size_t kb_size;
+	unsigned kb_class;
+	struct kprof_block *kb_next;	/* hash chain, or free list */
+};
+
+static struct kprof_site kprof_sites[KPROF_NSITES];
+static struct kprof_block kprof_blocks[KPROF_NBLOCKS];
+static struct kprof_block *kprof_buckets[KPROF_NBUCKETS];
+static struct kprof_block *kprof_freeblocks;
+static unsigned kprof_nextblock;	/* first never-used kprof_blocks[] */
+
+static unsigned kprof_untracked;	/* allocations not recorded */
+static unsigned kprof_nsites;
+static unsigned kprof_nlive;
+static size_t kprof_livebytes;
+static size_t kprof_maxbytes;
+
+/* When the allocation counts were last dumped, for rates. */
+static time_t kprof_lastsecs;
+static uint32_t kprof_lastnsecs;
+
+static struct spinlock kprof_lock = SPINLOCK_INITIALIZER;
+
+static
+struct kprof_site *
+kprof_getsite(vaddr_t site)
+{
+	struct kprof_site *ks;
+	unsigned i, h;
+
+	KASSERT(spinlock_do_i_hold(&kprof_lock));
+
+	h = KPROF_SITEHASH(site);
+	for (i=0; i<KPROF_NSITES; i++) {
+		ks = &kprof_sites[(h + i) & (KPROF_NSITES - 1)];
+		if (ks->ks_site == site) {
+			return ks;
+		}
+		if (ks->ks_site == 0) {
+			ks->ks_site = site;
+			kprof_nsites++;
+			return ks;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Record the allocation of SIZE bytes (of size class CLASS) at PTR,
+ * made from SITE.
+ */
+static
+void
+kprof_alloc(void *ptr, size_t size, unsigned class, vaddr_t site)
+{
+	struct kprof_site *ks;
+	struct kprof_block *kb;
+	unsigned h;
+
+	spinlock_acquire(&kprof_lock);
+
+	ks = kprof_getsite(site);
+	kb = kprof_freeblocks;
+	if (kb != NULL) {
+		kprof_freeblocks = kb->kb_next;
+	}
+	else if (kprof_nextblock < KPROF_NBLOCKS) {
+		kb = &kprof_blocks[kprof_nextblock++];
+	}
+	if (ks == NULL || kb == NULL) {
+		if (kb != NULL) {
+			kb->kb_next = kprof_freeblocks;
+			kprof_freeblocks = kb;
+		}
+		kprof_untracked++;
+		spinlock_release(&kprof_lock);
+		return;
+	}
+
+	kb->kb_addr = (vaddr_t)ptr;
+	kb->kb_site = ks;
+	kb->kb_size = size;
+	kb->kb_class = class;
+	h = KPROF_BLOCKHASH(kb->kb_addr);
+	kb->kb_next = kprof_buckets[h];
+	kprof_buckets[h] = kb;
+
+	ks->ks_classes |= (uint32_t)1 << class;
+	ks->ks_nallocs++;
+	ks->ks_nlive++;
+	ks->ks_livebytes += size;
+	if (ks->ks_livebytes > ks->ks_maxbytes) {
+		ks->ks_maxbytes = ks->ks_livebytes;
+	}
+
+	kprof_nlive++;
+	kprof_livebytes += size;
+	if (kprof_livebytes > kprof_maxbytes) {
+		kprof_maxbytes = kprof_livebytes;
+	}
+
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Forget the allocation at PTR, if it was recorded.
+ */
+static
+void
+kprof_free(void *ptr)
+{
+	struct kprof_block **kbp, *kb;
+	struct kprof_site *ks;
+
+	spinlock_acquire(&kprof_lock);
+
+	for (kbp = &kprof_buckets[KPROF_BLOCKHASH((vaddr_t)ptr)];
+	     *kbp != NULL; kbp = &(*kbp)->kb_next) {
+		if ((*kbp)->kb_addr == (vaddr_t)ptr) {
+			break;
+		}
+	}
+	kb = *kbp;
+	if (kb == NULL) {
+		spinlock_release(&kprof_lock);
+		return;
+	}
+	*kbp = kb->kb_next;
+
+	ks = kb->kb_site;
+	KASSERT(ks->ks_nlive > 0);
+	KASSERT(ks->ks_livebytes >= kb->kb_size);
+	ks->ks_nlive--;
+	ks->ks_livebytes -= kb->kb_size;
+	kprof_nlive--;
+	kprof_livebytes -= kb->kb_size;
+
+	kb->kb_next = kprof_freeblocks;
+	kprof_freeblocks = kb;
+
+	spinlock_release(&kprof_lock);
+}
+
+/*
+ * Print the size classes in the bitmap CLASSES into BUF.
+ */
+static
+void
+kprof_classes(char *buf, size_t len, uint32_t classes)
+{
+	unsigned i;
+	size_t pos;
+
+	pos = 0;
+	buf[0] = 0;
+	for (i=0; i<=KPROF_PAGES && pos < len; i++) {
+		if ((classes & ((uint32_t)1 << i)) == 0) {
+			continue;
+		}
+		if (i == KPROF_PAGES) {
+			snprintf(buf + pos, len - pos, "%spages",
+				 pos > 0 ? "," : "");
+		}
+		else {
+			snprintf(buf + pos, len - pos, "%s%lu",
+				 pos > 0 ? "," : "",
+				 (unsigned long)sizes[i]);
+		}
+		pos += strlen(buf + pos);
+	}
+}
+
+void
+kheap_printsites(unsigned n, bool byhighwater)
+{
+	bool done[KPROF_NSITES];
+	struct kprof_site *ks, *best;
+	time_t secs, lastsecs;
+	uint32_t nsecs, lastnsecs;
+	unsigned long msecs, rate;
+	char classes[48];
+	unsigned i, j;
+
+	gettime(&secs, &nsecs);
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kprof_lock);
+
+	lastsecs = kprof_lastsecs;
+	lastnsecs = kprof_lastnsecs;
+	kprof_lastsecs = secs;
+	kprof_lastnsecs = nsecs;
+	if (lastsecs == 0) {
+		msecs = 0;
+	}
+	else {
+		getinterval(lastsecs, lastnsecs, secs, nsecs, &secs, &nsecs);
+		msecs = secs * 1000 + nsecs / 1000000;
+	}
+
+	kprintf("kmalloc profile: %lu bytes live in %u blocks, "
+		"high-water %lu bytes\n", (unsigned long)kprof_livebytes,
+		kprof_nlive, (unsigned long)kprof_maxbytes);
+	kprintf("%u call sites, %u allocations untracked\n",
+		kprof_nsites, kprof_untracked);
+	kprintf("Top %u sites by %s:\n", n,
+		byhighwater ? "high-water mark" : "live bytes");
+	kprintf("  %-10s %8s %6s %9s %8s %8s  %s\n", "site", "live",
+		"blocks", "highwater", "allocs", "allocs/s", "sizes");
+
+	for (i=0; i<KPROF_NSITES; i++) {
+		done[i] = false;
+	}
+	for (i=0; i<n; i++) {
+		best = NULL;
+		for (j=0; j<KPROF_NSITES; j++) {
+			ks = &kprof_sites[j];
+			if (done[j] || ks->ks_site == 0) {
+				continue;
+			}
+			if (best == NULL ||
+			    (byhighwater ? ks->ks_maxbytes > best->ks_maxbytes
+			     : ks->ks_livebytes > best->ks_livebytes)) {
+				best = ks;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		done[best - kprof_sites] = true;
+
+		rate = 0;
+		if (msecs > 0) {
+			rate = (unsigned long)((uint64_t)(best->ks_nallocs -
+							  best->ks_lastnallocs)
+					       * 1000 / msecs);
+		}
+		kprof_classes(classes, sizeof(classes), best->ks_classes);
+		kprintf("  0x%08lx %8lu %6u %9lu %8u %8lu  %s\n",
+			(unsigned long)best->ks_site,
+			(unsigned long)best->ks_livebytes, best->ks_nlive,
+			(unsigned long)best->ks_maxbytes, best->ks_nallocs,
+			rate, classes);
+	}
+
+	/* Rates next time are from now. */
+	for (j=0; j<KPROF_NSITES; j++) {
+		kprof_sites[j].ks_lastnallocs = kprof_sites[j].ks_nallocs;
+	}
+
+	spinlock_release(&kprof_lock);
+}
+
+#endif /* OPT_KMALLOCPROF */
+
 //
 ////////////////////////////////////////////////////////////
 
 void *
 kmalloc(size_t sz)
 {
+	return kmalloc_at(sz, (vaddr_t)__builtin_return_address(0));
+}
+
+void *
+kmalloc_at(size_t sz, vaddr_t site)
+{
+#if OPT_KMALLOCPROF
+	void *ptr;
+#else
+	(void)site;
+#endif
+
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
 		vaddr_t address;
@@ -612,10 +1146,22 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 
+#if OPT_KMALLOCPROF
+		kprof_alloc((void *)address, npages * PAGE_SIZE, KPROF_PAGES,
+			    site);
+#endif
 		return (void *)address;
 	}
 
+#if OPT_KMALLOCPROF
+	ptr = subpage_kmalloc(sz);
+	if (ptr != NULL) {
+		kprof_alloc(ptr, sizes[blocktype(sz)], blocktype(sz), site);
+	}
+	return ptr;
+#else
 	return subpage_kmalloc(sz);
+#endif
 }
 
 void
@@ -626,7 +1172,11 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_KMALLOCPROF
+	kprof_free(ptr);
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
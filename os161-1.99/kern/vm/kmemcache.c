@@ -0,0 +1,236 @@
+/*
+ * Object caches. See kmemcache.h.
+ *
+ * Objects come from kmalloc and go back to it, so a cache is only a
+ * bounded stack of constructed objects in front of kmalloc. Each
+ * cache has a spinlock of its own; the constructor and destructor are
+ * always called without it, since they may sleep.
+ *
+ * A cache goes on the list of all caches (for kmem_cache_printstats)
+ * the first time anything is allocated from it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <kmemcache.h>
+
+/* Most objects kmem_cache_reapall destroys in one call. */
+#define KC_REAPBATCH	32
+
+static struct kmem_cache *kc_all;
+static struct spinlock kc_all_lock = SPINLOCK_INITIALIZER;
+
+static
+void
+kc_link(struct kmem_cache *kc)
+{
+	spinlock_acquire(&kc_all_lock);
+	if (!kc->kc_listed) {
+		kc->kc_next = kc_all;
+		kc_all = kc;
+		kc->kc_listed = true;
+	}
+	spinlock_release(&kc_all_lock);
+}
+
+static
+void
+kc_unlink(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+
+	spinlock_acquire(&kc_all_lock);
+	if (kc->kc_listed) {
+		for (kcp = &kc_all; *kcp != kc; kcp = &(*kcp)->kc_next) {
+			KASSERT(*kcp != NULL);
+		}
+		*kcp = kc->kc_next;
+		kc->kc_listed = false;
+	}
+	spinlock_release(&kc_all_lock);
+}
+
+/*
+ * Give an object back to kmalloc.
+ */
+static
+void
+kc_destroyobj(struct kmem_cache *kc, void *obj)
+{
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	KASSERT(size > 0);
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	kc->kc_maxfree = KC_MAXFREE;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_nfree = 0;
+	kc->kc_ninuse = 0;
+	kc->kc_nallocs = 0;
+	kc->kc_nhits = 0;
+	kc->kc_listed = false;
+	kc->kc_next = NULL;
+	return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	KASSERT(kc->kc_ninuse == 0);
+
+	kc_unlink(kc);
+	kmem_cache_reap(kc);
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+	int result;
+
+	KASSERT(kc->kc_maxfree <= KC_MAXFREE);
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_nallocs++;
+	if (kc->kc_nfree > 0) {
+		obj = kc->kc_free[--kc->kc_nfree];
+		kc->kc_nhits++;
+		kc->kc_ninuse++;
+		spinlock_release(&kc->kc_lock);
+		return obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (!kc->kc_listed) {
+		kc_link(kc);
+	}
+
+	obj = kmalloc_at(kc->kc_size,
+			 (vaddr_t)__builtin_return_address(0));
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL) {
+		result = kc->kc_ctor(obj);
+		if (result) {
+			kfree(obj);
+			return NULL;
+		}
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_ninuse++;
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_ninuse > 0);
+	kc->kc_ninuse--;
+	if (kc->kc_nfree < kc->kc_maxfree) {
+		kc->kc_free[kc->kc_nfree++] = obj;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	kc_destroyobj(kc, obj);
+}
+
+void
+kmem_cache_reap(struct kmem_cache *kc)
+{
+	void *obj;
+
+	while (1) {
+		spinlock_acquire(&kc->kc_lock);
+		if (kc->kc_nfree == 0) {
+			spinlock_release(&kc->kc_lock);
+			break;
+		}
+		obj = kc->kc_free[--kc->kc_nfree];
+		spinlock_release(&kc->kc_lock);
+
+		kc_destroyobj(kc, obj);
+	}
+}
+
+/*
+ * The free objects are taken off their caches under the locks, and
+ * destroyed after, with the destructor that goes with each, so a
+ * dynamic cache can be destroyed meanwhile without harm.
+ */
+unsigned
+kmem_cache_reapall(void)
+{
+	void (*dtors[KC_REAPBATCH])(void *obj);
+	void *objs[KC_REAPBATCH];
+	struct kmem_cache *kc;
+	unsigned n, i;
+
+	n = 0;
+	spinlock_acquire(&kc_all_lock);
+	for (kc = kc_all; kc != NULL && n < KC_REAPBATCH; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		while (kc->kc_nfree > 0 && n < KC_REAPBATCH) {
+			objs[n] = kc->kc_free[--kc->kc_nfree];
+			dtors[n] = kc->kc_dtor;
+			n++;
+		}
+		spinlock_release(&kc->kc_lock);
+	}
+	spinlock_release(&kc_all_lock);
+
+	for (i = 0; i < n; i++) {
+		if (dtors[i] != NULL) {
+			dtors[i](objs[i]);
+		}
+		kfree(objs[i]);
+	}
+	return n;
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *kc;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kc_all_lock);
+
+	kprintf("Object cache status:\n");
+	kprintf("  %-16s %6s %6s %6s %10s %10s\n", "name", "size",
+		"inuse", "free", "allocs", "hits");
+	for (kc = kc_all; kc != NULL; kc = kc->kc_next) {
+		kprintf("  %-16s %6u %6u %6u %10u %10u\n", kc->kc_name,
+			kc->kc_size, kc->kc_ninuse, kc->kc_nfree,
+			kc->kc_nallocs, kc->kc_nhits);
+	}
+
+	spinlock_release(&kc_all_lock);
+}
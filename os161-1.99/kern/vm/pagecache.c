@@ -0,0 +1,360 @@
+/*
+ * Page cache. See pagecache.h.
+ *
+ * Each cached page has an entry on a hash chain by (vnode, offset)
+ * and on the LRU list, coldest first. Everything, including the
+ * cache's changes to the frames' reference counts, happens under
+ * pc_lock, so a lookup can't race with the entry going away, and
+ * pagecache_reclaim can tell from a frame's reference count alone
+ * whether dropping it from the cache frees it.
+ *
+ * An evicted entry goes on pc_dead until pagecache_reap lets go of
+ * its vnode.
+ *
+ * pp_nshared counts the PTEs of shared file mappings that map the
+ * entry's frame. Those may have written to it, so while there are any
+ * the entry stays put: dropping it would let the next read of the file
+ * go to disk, which doesn't have the writes yet.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <coremap.h>
+#include <pagecache.h>
+#include <uw-vmstats.h>
+
+/* Number of hash chains; must be a power of 2. */
+#define PC_NBUCKETS	256
+
+/* Entries pagecache_reclaim looks at, per frame it is asked for. */
+#define PC_RECLAIM_SCAN	4
+
+#define PC_KEYHASH(v, off) \
+	((((uintptr_t)(v) >> 4) ^ (uint32_t)((off) / PAGE_SIZE)) & \
+	 (PC_NBUCKETS - 1))
+
+struct pc_page {
+	struct vnode *pp_vnode;
+	off_t pp_offset;
+	paddr_t pp_paddr;
+	struct pc_page *pp_next;	/* hash chain, or pc_dead */
+	struct pc_page *pp_lruprev;
+	struct pc_page *pp_lrunext;
+	unsigned pp_nshared;		/* shared mappings of the frame */
+};
+
+static struct pc_page *pc_bykey[PC_NBUCKETS];
+static struct pc_page *pc_lruhead, *pc_lrutail;
+static struct pc_page *pc_dead;
+
+static struct spinlock pc_lock = SPINLOCK_INITIALIZER;
+
+static
+struct pc_page *
+pc_find(struct vnode *v, off_t offset)
+{
+	struct pc_page *pp;
+
+	KASSERT(spinlock_do_i_hold(&pc_lock));
+
+	for (pp = pc_bykey[PC_KEYHASH(v, offset)]; pp != NULL;
+	     pp = pp->pp_next) {
+		if (pp->pp_vnode == v && pp->pp_offset == offset) {
+			return pp;
+		}
+	}
+	return NULL;
+}
+
+static
+void
+pc_lru_append(struct pc_page *pp)
+{
+	KASSERT(spinlock_do_i_hold(&pc_lock));
+
+	pp->pp_lrunext = NULL;
+	pp->pp_lruprev = pc_lrutail;
+	if (pc_lrutail != NULL) {
+		pc_lrutail->pp_lrunext = pp;
+	}
+	else {
+		pc_lruhead = pp;
+	}
+	pc_lrutail = pp;
+}
+
+static
+void
+pc_lru_remove(struct pc_page *pp)
+{
+	KASSERT(spinlock_do_i_hold(&pc_lock));
+
+	if (pp->pp_lruprev != NULL) {
+		pp->pp_lruprev->pp_lrunext = pp->pp_lrunext;
+	}
+	else {
+		pc_lruhead = pp->pp_lrunext;
+	}
+	if (pp->pp_lrunext != NULL) {
+		pp->pp_lrunext->pp_lruprev = pp->pp_lruprev;
+	}
+	else {
+		pc_lrutail = pp->pp_lruprev;
+	}
+}
+
+/*
+ * Take PP out of the cache and drop the cache's reference to its
+ * frame. Returns true if that freed the frame.
+ */
+static
+bool
+pc_evict(struct pc_page *pp)
+{
+	struct pc_page **ppp;
+	bool freed;
+
+	KASSERT(spinlock_do_i_hold(&pc_lock));
+
+	for (ppp = &pc_bykey[PC_KEYHASH(pp->pp_vnode, pp->pp_offset)];
+	     *ppp != pp; ppp = &(*ppp)->pp_next) {
+		KASSERT(*ppp != NULL);
+	}
+	*ppp = pp->pp_next;
+	pc_lru_remove(pp);
+
+	freed = coremap_refcount(pp->pp_paddr) == 1;
+	coremap_decref(pp->pp_paddr);
+
+	pp->pp_next = pc_dead;
+	pc_dead = pp;
+	return freed;
+}
+
+paddr_t
+pagecache_get(struct vnode *v, off_t offset)
+{
+	struct pc_page *pp;
+	paddr_t pa;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	spinlock_acquire(&pc_lock);
+	pp = pc_find(v, offset);
+	if (pp == NULL) {
+		spinlock_release(&pc_lock);
+		return 0;
+	}
+	pa = pp->pp_paddr;
+	coremap_incref(pa);
+	pc_lru_remove(pp);
+	pc_lru_append(pp);
+	spinlock_release(&pc_lock);
+
+	return pa;
+}
+
+bool
+pagecache_add(struct vnode *v, off_t offset, paddr_t *pa)
+{
+	struct pc_page *pp, *newpp;
+	unsigned h;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	/* kmalloc may need the VM, so not under the spinlock. */
+	newpp = kmalloc(sizeof(struct pc_page));
+	if (newpp == NULL) {
+		return false;
+	}
+
+	spinlock_acquire(&pc_lock);
+	pp = pc_find(v, offset);
+	if (pp != NULL) {
+		/* Someone else read it in at the same time. */
+		coremap_incref(pp->pp_paddr);
+		coremap_decref(*pa);
+		*pa = pp->pp_paddr;
+		spinlock_release(&pc_lock);
+		kfree(newpp);
+		return true;
+	}
+
+	newpp->pp_vnode = v;
+	newpp->pp_offset = offset;
+	newpp->pp_paddr = *pa;
+	newpp->pp_nshared = 0;
+	h = PC_KEYHASH(v, offset);
+	newpp->pp_next = pc_bykey[h];
+	pc_bykey[h] = newpp;
+	pc_lru_append(newpp);
+	coremap_incref(*pa);
+	VOP_INCREF(v);
+	spinlock_release(&pc_lock);
+	return true;
+}
+
+void
+pagecache_release(paddr_t pa)
+{
+	spinlock_acquire(&pc_lock);
+	coremap_decref(pa);
+	spinlock_release(&pc_lock);
+}
+
+void
+pagecache_release_busy(paddr_t pa)
+{
+	spinlock_acquire(&pc_lock);
+	coremap_decref_busy(pa);
+	spinlock_release(&pc_lock);
+}
+
+bool
+pagecache_share(struct vnode *v, off_t offset, paddr_t pa)
+{
+	struct pc_page *pp;
+	bool shared;
+
+	spinlock_acquire(&pc_lock);
+	pp = pc_find(v, offset);
+	shared = pp != NULL && pp->pp_paddr == pa;
+	if (shared) {
+		pp->pp_nshared++;
+	}
+	spinlock_release(&pc_lock);
+	return shared;
+}
+
+void
+pagecache_unshare(struct vnode *v, off_t offset, paddr_t pa)
+{
+	struct pc_page *pp;
+
+	spinlock_acquire(&pc_lock);
+	pp = pc_find(v, offset);
+	if (pp != NULL && pp->pp_paddr == pa) {
+		KASSERT(pp->pp_nshared > 0);
+		pp->pp_nshared--;
+	}
+	spinlock_release(&pc_lock);
+}
+
+void
+pagecache_truncate(struct vnode *v, off_t len)
+{
+	struct pc_page *pp;
+	off_t start;
+
+	spinlock_acquire(&pc_lock);
+	for (pp = pc_lruhead; pp != NULL; pp = pp->pp_lrunext) {
+		if (pp->pp_vnode != v || pp->pp_offset + PAGE_SIZE <= len) {
+			continue;
+		}
+		start = len > pp->pp_offset ? len - pp->pp_offset : 0;
+		bzero((char *)PADDR_TO_KVADDR(pp->pp_paddr) + start,
+		      PAGE_SIZE - start);
+	}
+	spinlock_release(&pc_lock);
+}
+
+void
+pagecache_purge(struct vnode *v)
+{
+	struct pc_page *pp, *next;
+
+	spinlock_acquire(&pc_lock);
+	for (pp = pc_lruhead; pp != NULL; pp = next) {
+		next = pp->pp_lrunext;
+		if (pp->pp_vnode == v && pp->pp_nshared == 0) {
+			pc_evict(pp);
+		}
+	}
+	spinlock_release(&pc_lock);
+
+	/* The caller's reference keeps V itself from being reclaimed. */
+	pagecache_reap();
+}
+
+void
+pagecache_flush(struct fs *fs)
+{
+	struct pc_page *pp, *next;
+
+	spinlock_acquire(&pc_lock);
+	for (pp = pc_lruhead; pp != NULL; pp = next) {
+		next = pp->pp_lrunext;
+		if (pp->pp_vnode->vn_fs == fs && pp->pp_nshared == 0) {
+			pc_evict(pp);
+		}
+	}
+	spinlock_release(&pc_lock);
+
+	pagecache_reap();
+}
+
+unsigned
+pagecache_reclaim(unsigned n)
+{
+	struct pc_page *pp, *next;
+	unsigned nfreed, nscan, i;
+
+	nfreed = 0;
+	spinlock_acquire(&pc_lock);
+
+	/*
+	 * Evicting a page someone has mapped frees nothing, so skip
+	 * those, and give up after a few times N entries rather than
+	 * run through the whole cache.
+	 */
+	nscan = n * PC_RECLAIM_SCAN;
+	for (pp = pc_lruhead; pp != NULL && nfreed < n && nscan > 0;
+	     pp = next, nscan--) {
+		next = pp->pp_lrunext;
+		if (coremap_refcount(pp->pp_paddr) == 1) {
+			pc_evict(pp);
+			nfreed++;
+		}
+	}
+
+	/*
+	 * If the cold end is all mapped, let go of the coldest N of
+	 * them anyway. Their frames stay mapped but, with only the page
+	 * tables holding them, can be paged out like anything else.
+	 * Not pages of shared mappings, though.
+	 */
+	if (nfreed == 0) {
+		for (pp = pc_lruhead, i = 0; pp != NULL && i < n; pp = next) {
+			next = pp->pp_lrunext;
+			if (pp->pp_nshared == 0) {
+				pc_evict(pp);
+				i++;
+			}
+		}
+	}
+
+	spinlock_release(&pc_lock);
+	return nfreed;
+}
+
+void
+pagecache_reap(void)
+{
+	struct pc_page *pp;
+
+	while (1) {
+		spinlock_acquire(&pc_lock);
+		pp = pc_dead;
+		if (pp == NULL) {
+			spinlock_release(&pc_lock);
+			break;
+		}
+		pc_dead = pp->pp_next;
+		spinlock_release(&pc_lock);
+
+		VOP_DECREF(pp->pp_vnode);
+		kfree(pp);
+	}
+}
@@ -0,0 +1,96 @@
+/*
+ * Two-level page tables. See pagetable.h.
+ *
+ * Both levels are exactly one page (1024 32-bit words), so they come
+ * straight from alloc_kpages via kmalloc.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+	struct pagetable *pt;
+	unsigned i;
+
+	COMPILE_ASSERT(sizeof(struct pagetable) == PAGE_SIZE);
+
+	pt = kmalloc(sizeof(*pt));
+	if (pt == NULL) {
+		return NULL;
+	}
+	for (i = 0; i < PT_NENTRIES; i++) {
+		pt->pt_dir[i] = NULL;
+	}
+	return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+	unsigned i;
+
+	KASSERT(pt != NULL);
+
+	for (i = 0; i < PT_NENTRIES; i++) {
+		if (pt->pt_dir[i] != NULL) {
+			kfree(pt->pt_dir[i]);
+		}
+	}
+	kfree(pt);
+}
+
+pte_t *
+pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+	pte_t *l2;
+	unsigned i;
+
+	KASSERT(pt != NULL);
+
+	l2 = pt->pt_dir[PT_L1INDEX(vaddr)];
+	if (l2 == NULL) {
+		if (!create) {
+			return NULL;
+		}
+		l2 = kmalloc(PT_NENTRIES * sizeof(pte_t));
+		if (l2 == NULL) {
+			return NULL;
+		}
+		for (i = 0; i < PT_NENTRIES; i++) {
+			l2[i] = 0;
+		}
+		pt->pt_dir[PT_L1INDEX(vaddr)] = l2;
+	}
+	return &l2[PT_L2INDEX(vaddr)];
+}
+
+int
+pt_walk(struct pagetable *pt, pt_walkfunc func, void *data)
+{
+	unsigned i, j;
+	pte_t *l2;
+	int result;
+
+	KASSERT(pt != NULL);
+
+	for (i = 0; i < PT_NENTRIES; i++) {
+		l2 = pt->pt_dir[i];
+		if (l2 == NULL) {
+			continue;
+		}
+		for (j = 0; j < PT_NENTRIES; j++) {
+			if (l2[j] == 0) {
+				continue;
+			}
+			result = func((vaddr_t)((i << 22) | (j << 12)),
+				      &l2[j], data);
+			if (result) {
+				return result;
+			}
+		}
+	}
+	return 0;
+}
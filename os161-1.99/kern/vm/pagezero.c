@@ -0,0 +1,110 @@
+/*
+ * Background page zeroing. See pagezero.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <coremap.h>
+#include <pagezero.h>
+
+/* Frames kept in the pool, and the level that wakes the thread. */
+#define PAGEZERO_MAX	32
+#define PAGEZERO_LOW	16
+
+/* Don't take frames for the pool when fewer than this are free. */
+#define PAGEZERO_MINFREE 64
+
+static paddr_t pz_pool[PAGEZERO_MAX];
+static unsigned pz_count;
+static struct wchan *pz_wchan;		/* the zeroing thread sleeps here */
+static struct spinlock pz_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * The zeroing thread. Tops the pool up to PAGEZERO_MAX, as far as free
+ * memory allows, and then sleeps until pagezero_get takes the pool
+ * below PAGEZERO_LOW.
+ */
+static
+void
+pagezero_thread(void *unused1, unsigned long unused2)
+{
+	paddr_t pa;
+	bool roomy;
+
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		while (pz_count < PAGEZERO_MAX &&
+		       coremap_freecount() >= PAGEZERO_MINFREE) {
+			pa = coremap_alloc(1);
+			if (pa == 0) {
+				break;
+			}
+			bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+
+			spinlock_acquire(&pz_lock);
+			KASSERT(pz_count < PAGEZERO_MAX);
+			pz_pool[pz_count++] = pa;
+			spinlock_release(&pz_lock);
+
+			/* let anything that's actually runnable go first */
+			thread_yield();
+		}
+
+		/*
+		 * Check the count and go to sleep under pz_lock, which
+		 * pagezero_get holds when it wakes us, so a wakeup that
+		 * comes in between can't be lost.
+		 */
+		roomy = coremap_freecount() >= PAGEZERO_MINFREE;
+		spinlock_acquire(&pz_lock);
+		if (pz_count < PAGEZERO_LOW && roomy) {
+			spinlock_release(&pz_lock);
+			continue;
+		}
+		wchan_lock(pz_wchan);
+		spinlock_release(&pz_lock);
+		wchan_sleep(pz_wchan);
+	}
+}
+
+void
+pagezero_bootstrap(void)
+{
+	int result;
+
+	pz_wchan = wchan_create("pagezero");
+	if (pz_wchan == NULL) {
+		panic("pagezero_bootstrap: out of memory\n");
+	}
+	pz_count = 0;
+
+	result = thread_fork("pagezero", NULL, pagezero_thread, NULL, 0);
+	if (result) {
+		panic("pagezero_bootstrap: thread_fork: %s\n",
+		      strerror(result));
+	}
+}
+
+paddr_t
+pagezero_get(void)
+{
+	paddr_t pa;
+
+	spinlock_acquire(&pz_lock);
+	if (pz_count == 0) {
+		pa = 0;
+	}
+	else {
+		pa = pz_pool[--pz_count];
+	}
+	if (pz_count < PAGEZERO_LOW) {
+		wchan_wakeone(pz_wchan);
+	}
+	spinlock_release(&pz_lock);
+	return pa;
+}
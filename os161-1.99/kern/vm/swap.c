@@ -0,0 +1,214 @@
+/*
+ * Swap space on a raw disk. See swap.h.
+ *
+ * The swap disk is used through the vnode that vfs provides for the
+ * raw device, so every transfer goes through dev_read/dev_write to the
+ * disk driver's d_io. Slot N occupies bytes [N*PAGE_SIZE, (N+1)*PAGE_SIZE)
+ * of the disk.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/iovec.h>
+#include <stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <uw-vmstats.h>
+#include <vm.h>
+#include <swap.h>
+
+#define SWAP_DEVICE	"lhd1raw:"
+
+/* Most pages written by a single disk request. */
+#define SWAP_MAXRUN	8
+
+static struct vnode *swap_vnode;	/* NULL if there is no swap */
+static unsigned swap_nslots;
+static struct bitmap *swap_map;		/* slots in use */
+static uint16_t *swap_refs;		/* references to each slot */
+
+/* Protects swap_map and swap_refs. */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void
+swap_bootstrap(void)
+{
+	char path[sizeof(SWAP_DEVICE)];
+	struct stat st;
+	unsigned i;
+	int result;
+
+	/* vfs_open scribbles on the path */
+	strcpy(path, SWAP_DEVICE);
+	result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+	if (result) {
+		kprintf("swap: cannot open %s: %s; swapping disabled\n",
+			SWAP_DEVICE, strerror(result));
+		swap_vnode = NULL;
+		return;
+	}
+
+	result = VOP_STAT(swap_vnode, &st);
+	if (result) {
+		panic("swap: stat %s: %s\n", SWAP_DEVICE, strerror(result));
+	}
+	swap_nslots = st.st_size / PAGE_SIZE;
+	if (swap_nslots == 0) {
+		kprintf("swap: %s is too small; swapping disabled\n",
+			SWAP_DEVICE);
+		vfs_close(swap_vnode);
+		swap_vnode = NULL;
+		return;
+	}
+
+	swap_map = bitmap_create(swap_nslots);
+	swap_refs = kmalloc(swap_nslots * sizeof(uint16_t));
+	if (swap_map == NULL || swap_refs == NULL) {
+		panic("swap: out of memory for %u slots\n", swap_nslots);
+	}
+	for (i = 0; i < swap_nslots; i++) {
+		swap_refs[i] = 0;
+	}
+
+	kprintf("swap: %u pages on %s\n", swap_nslots, SWAP_DEVICE);
+}
+
+int
+swap_alloc(unsigned *slot)
+{
+	int result;
+
+	if (swap_vnode == NULL) {
+		return ENOSPC;
+	}
+
+	spinlock_acquire(&swap_lock);
+	result = bitmap_alloc(swap_map, slot);
+	if (result == 0) {
+		KASSERT(swap_refs[*slot] == 0);
+		swap_refs[*slot] = 1;
+	}
+	spinlock_release(&swap_lock);
+
+	if (result) {
+		vmstats_inc(VMSTAT_SWAP_FULL);
+		return ENOSPC;
+	}
+	return 0;
+}
+
+void
+swap_incref(unsigned slot)
+{
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+	swap_refs[slot]++;
+	spinlock_release(&swap_lock);
+}
+
+void
+swap_decref(unsigned slot)
+{
+	bool freed = false;
+
+	KASSERT(slot < swap_nslots);
+
+	spinlock_acquire(&swap_lock);
+	KASSERT(swap_refs[slot] > 0);
+	if (--swap_refs[slot] == 0) {
+		bitmap_unmark(swap_map, slot);
+		freed = true;
+	}
+	spinlock_release(&swap_lock);
+
+	if (freed) {
+		vmstats_inc(VMSTAT_SWAP_FREE);
+	}
+}
+
+int
+swap_read(unsigned slot, paddr_t paddr)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+	KASSERT(slot < swap_nslots);
+
+	uio_kinit(&iov, &ku, (void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+		  (off_t)slot * PAGE_SIZE, UIO_READ);
+	result = VOP_READ(swap_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	vmstats_inc(VMSTAT_SWAP_FILE_READ);
+	return 0;
+}
+
+/*
+ * Write N frames to consecutive slots starting at SLOT, as one
+ * request with an iovec per frame.
+ */
+static
+int
+swap_write_run(unsigned n, const paddr_t *paddrs, unsigned slot)
+{
+	struct iovec iov[SWAP_MAXRUN];
+	struct uio ku;
+	unsigned i;
+	int result;
+
+	KASSERT(n > 0 && n <= SWAP_MAXRUN);
+	KASSERT(slot + n <= swap_nslots);
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(paddrs[i]);
+		iov[i].iov_len = PAGE_SIZE;
+	}
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = n;
+	ku.uio_offset = (off_t)slot * PAGE_SIZE;
+	ku.uio_resid = n * PAGE_SIZE;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_WRITE;
+	ku.uio_space = NULL;
+
+	result = VOP_WRITE(swap_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	for (i = 0; i < n; i++) {
+		vmstats_inc(VMSTAT_SWAP_FILE_WRITE);
+	}
+	return 0;
+}
+
+int
+swap_write(unsigned npages, const paddr_t *paddrs, const unsigned *slots)
+{
+	unsigned i, n;
+	int result;
+
+	KASSERT(swap_vnode != NULL);
+
+	for (i = 0; i < npages; i += n) {
+		n = 1;
+		while (i + n < npages && n < SWAP_MAXRUN &&
+		       slots[i + n] == slots[i] + n) {
+			n++;
+		}
+		result = swap_write_run(n, &paddrs[i], slots[i]);
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
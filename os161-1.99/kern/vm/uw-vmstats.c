@@ -4,23 +4,23 @@
 
 /* NOTE !!!!!! WARNING !!!!!
  * All of the functions whose names begin with '_'
- * assume that atomicity is ensured elsewhere
- * (i.e., outside of these routines) by acquiring stats_lock.
+ * assume that interrupts are already off, so that the
+ * calling thread stays on the cpu whose counters it bumps.
  * All of the functions whose names do not begin
- * with '_' ensure atomicity locally.
+ * with '_' turn interrupts off themselves.
+ *
+ * The counters are per-cpu (c_vmstats in struct cpu), so bumping
+ * one takes no lock and touches no cache line another cpu writes.
+ * Reading them means adding up all the cpus' copies.
  */
 
 #include <types.h>
 #include <lib.h>
-#include <synch.h>
+#include <cpu.h>
+#include <current.h>
 #include <spl.h>
 #include <uw-vmstats.h>
 
-/* Counters for tracking statistics */
-static unsigned int stats_counts[VMSTAT_COUNT];
-
-struct spinlock stats_lock = SPINLOCK_INITIALIZER;
-
 /* Strings used in printing out the statistics */
 static const char *stats_names[] = {
  /*  0 */ "TLB Faults", 
@@ -33,6 +33,18 @@ static const char *stats_names[] = {
  /*  7 */ "Page Faults from ELF",
  /*  8 */ "Page Faults from Swapfile",
  /*  9 */ "Swapfile Writes",
+ /* 10 */ "TLB Invalidations avoided",
+ /* 11 */ "Shootdown IPIs sent",
+ /* 12 */ "Shootdown invalidations",
+ /* 13 */ "TLB Preload hits",
+ /* 14 */ "TLB Preload misses",
+ /* 15 */ "COW Faults (Copied)",
+ /* 16 */ "COW Faults (Reused)",
+ /* 17 */ "Swapfile Frees",
+ /* 18 */ "Swapfile Full",
+ /* 19 */ "Page Cache Hits",
+ /* 20 */ "Page Cache Misses",
+ /* 21 */ "Zero Page Faults (Written)",
 };
 
 
@@ -41,23 +53,26 @@ static const char *stats_names[] = {
 void
 vmstats_inc(unsigned int index)
 {
-    spinlock_acquire(&stats_lock);
-      _vmstats_inc(index);
-    spinlock_release(&stats_lock);
+  int spl;
+
+  spl = splhigh();
+    _vmstats_inc(index);
+  splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
 void
 vmstats_init(void)
 {
-  /* Although the spinlock is initialized at declaration time we do it here
-   * again in case we want use/reset these stats repeatedly without shutting down the kernel.
-   */
-  spinlock_init(&stats_lock);
+  int spl;
 
-  spinlock_acquire(&stats_lock);
+  /* This may be called again to reset the stats without shutting down
+   * the kernel. Other cpus are not stopped, so counts they bump while
+   * it runs may or may not survive the reset.
+   */
+  spl = splhigh();
     _vmstats_init();
-  spinlock_release(&stats_lock);
+  splx(spl);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -65,13 +80,16 @@ void
 _vmstats_inc(unsigned int index)
 {
   KASSERT(index < VMSTAT_COUNT);
-  stats_counts[index]++;
+  KASSERT(curthread->t_curspl > 0);
+  curcpu->c_vmstats[index]++;
 }
 
 /* ---------------------------------------------------------------------- */
 void
 _vmstats_init(void)
 {
+  struct cpu *c;
+  unsigned n;
   int i = 0;
 
   if (sizeof(stats_names) / sizeof(char *) != VMSTAT_COUNT) {
@@ -80,16 +98,40 @@ _vmstats_init(void)
     panic("Should really fix this before proceeding\n");
   }
 
+  for (n=0; (c = cpu_bynumber(n)) != NULL; n++) {
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      c->c_vmstats[i] = 0;
+    }
+  }
+
+}
+
+/* ---------------------------------------------------------------------- */
+void
+vmstats_snapshot(unsigned int *counts)
+{
+  struct cpu *c;
+  unsigned n;
+  int i = 0;
+
   for (i=0; i<VMSTAT_COUNT; i++) {
-    stats_counts[i] = 0;
+    counts[i] = 0;
   }
 
+  /* No lock: each word is only ever written by its own cpu, and
+   * reading an aligned word gets either the old or the new value.
+   */
+  for (n=0; (c = cpu_bynumber(n)) != NULL; n++) {
+    for (i=0; i<VMSTAT_COUNT; i++) {
+      counts[i] += c->c_vmstats[i];
+    }
+  }
 }
 
 /* ---------------------------------------------------------------------- */
 /* Assumes vmstat_init has already been called */
-/* NOTE: We do not grab the spinlock here because kprintf may block
- * and we can't block while holding a spinlock.
+/* NOTE: This works from a snapshot, so if other threads are still
+ * faulting the totals below may not quite add up.
  * Just use this when there is only one thread remaining.
  */
 
@@ -102,6 +144,9 @@ vmstats_print(void)
   int tlb_faults = 0;
   int elf_plus_swap_reads = 0;
   int disk_reads = 0;
+  unsigned int stats_counts[VMSTAT_COUNT];
+
+  vmstats_snapshot(stats_counts);
 
   kprintf("VMSTATS:\n");
   for (i=0; i<VMSTAT_COUNT; i++) {
@@ -111,7 +156,8 @@ vmstats_print(void)
   tlb_faults = stats_counts[VMSTAT_TLB_FAULT];
   free_plus_replace = stats_counts[VMSTAT_TLB_FAULT_FREE] + stats_counts[VMSTAT_TLB_FAULT_REPLACE];
   disk_plus_zeroed_plus_reload = stats_counts[VMSTAT_PAGE_FAULT_DISK] +
-    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD];
+    stats_counts[VMSTAT_PAGE_FAULT_ZERO] + stats_counts[VMSTAT_TLB_RELOAD] +
+    stats_counts[VMSTAT_PAGECACHE_HIT];
   elf_plus_swap_reads = stats_counts[VMSTAT_ELF_FILE_READ] + stats_counts[VMSTAT_SWAP_FILE_READ];
   disk_reads = stats_counts[VMSTAT_PAGE_FAULT_DISK];
 
@@ -121,10 +167,10 @@ vmstats_print(void)
       tlb_faults, free_plus_replace); 
   }
 
-  kprintf("VMSTAT TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) = %d\n",
+  kprintf("VMSTAT TLB Reloads + Page Cache Hits + Page Faults (Zeroed) + Page Faults (Disk) = %d\n",
     disk_plus_zeroed_plus_reload);
   if (tlb_faults != disk_plus_zeroed_plus_reload) {
-    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Faults (Zeroed) + Page Faults (Disk) (%d)\n",
+    kprintf("WARNING: TLB Faults (%d) != TLB Reloads + Page Cache Hits + Page Faults (Zeroed) + Page Faults (Disk) (%d)\n",
       tlb_faults, disk_plus_zeroed_plus_reload); 
   }
 
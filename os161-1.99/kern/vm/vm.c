@@ -0,0 +1,1170 @@
+/*
+ * Paged VM system: kernel page allocation, TLB handling and the page
+ * fault handler.
+ *
+ * User pages are allocated on demand. A TLB miss on a page inside a
+ * region looks up its PTE; if the page has never been touched it gets
+ * a fresh frame, zero-filled or, for the parts of ELF segments that
+ * come from the executable, read from the file. Either way the
+ * translation is then loaded into the TLB. Zero-fill faults take a
+ * frame from the pool the background zeroing thread keeps, if it has
+ * one.
+ *
+ * Pages of read-only ELF segments (program text) that are all file
+ * data come from the page cache (see pagecache.h): the fault handler
+ * gets the frame from the file system with VOP_MMAP, which reads the
+ * page into the cache if it isn't there already, and maps that frame
+ * itself rather than a copy, marking the PTE PTE_PCACHE. File systems
+ * without a page cache return an error, and the page is read into a
+ * private frame as for any other segment. Processes running the same
+ * program share the frames, and so does running it again later. Such
+ * a page is never dirty, so eviction just unmaps it.
+ *
+ * Pages shared copy-on-write after fork are mapped read-only. A
+ * write to one (a VM_FAULT_READONLY, or a VM_FAULT_WRITE miss) gets
+ * the process its own copy of the frame, unless it already holds the
+ * only reference, in which case the page is simply made writable.
+ * Zero-fill pages are handled the same way: a read of one that has
+ * never been touched maps a single shared frame of zeros, copy-on-
+ * write, and only the first write gets it a frame of its own. The
+ * parts of a sparse array that are only ever read take no frames.
+ *
+ * When memory runs out, vm_pageout evicts a batch of pages chosen by
+ * the coremap's clock algorithm, writing them to swap together, and
+ * their PTEs are changed to name the swap slots. A fault on such a
+ * page reads it back in.
+ *
+ * Anonymous regions made by mmap are zero-filled like the heap. Pages
+ * of shared ones (VR_SHARED) never map the zero page, since as_copy
+ * shares their frames with the child as they are rather than
+ * copy-on-write.
+ *
+ * Mappings of files map the page cache's frames like program text.
+ * Private ones map them copy-on-write if they are writable; a write
+ * miss goes straight to a private copy read from the file. Shared ones
+ * map them as they are, but read-only at first: the first write to
+ * each page faults, marks the PTE PTE_DIRTY, and makes the page
+ * writable, so as_sync knows which pages to write back. Dirty pages
+ * are never evicted, as that would lose the writes.
+ *
+ * A TLB miss also preloads entries for the next few resident pages of
+ * the region ("fault-around"), so walking through an array or code
+ * costs one trap per window instead of one per page. The hardware
+ * doesn't say whether a preloaded entry got used, so each region
+ * judges its last window by where the next miss in it lands: right
+ * after the window means all of it was used, inside it means the
+ * entries from there on were wasted (or evicted before use). The
+ * window doubles after a fully used one and halves when most of it
+ * was wasted.
+ *
+ * Each cpu also keeps a software TLB: a direct-mapped cache of the
+ * entries it has loaded, tagged with the same PID. A miss on a page
+ * the hardware TLB only lost to replacement is refilled from there
+ * without looking at the address space at all. Every invalidation of
+ * the hardware TLB (shootdowns and ASID rollover) applies to the
+ * software one too, so it never holds anything the TLB couldn't.
+ *
+ * Faults, and everything else the owner of an address space does to
+ * its page table, are serialized by the address space's own as_lock,
+ * so processes fault in parallel. Page replacement takes no lock at
+ * all while it picks victims and writes them to swap: a victim's frame
+ * is marked busy in the coremap, and only whoever has a frame busy may
+ * change the PTE that maps it. So the fault path pins (coremap_pin)
+ * the frame it is working on, waiting for it if it is on its way out,
+ * and keeps it pinned until its TLB entry is loaded. Before a victim
+ * is written out its TLB entries are shot down on every cpu, and
+ * vm_pageout waits for them all to finish, so nothing can write the
+ * page while it is going to disk. The fault path never touches user
+ * memory while holding as_lock, so it cannot fault recursively.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/iovec.h>
+#include <lib.h>
+#include <spl.h>
+#include <cpu.h>
+#include <thread.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <mips/tlb.h>
+#include <addrspace.h>
+#include <pagetable.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagezero.h>
+#include <pagecache.h>
+#include <kmemcache.h>
+#include <uw-vmstats.h>
+#include <vm.h>
+
+/* Most pages evicted (and written to swap) by one vm_pageout. */
+#define VM_PAGEOUT_BATCH	8
+#if VM_PAGEOUT_BATCH > TLBSHOOTDOWN_MAX
+#error "VM_PAGEOUT_BATCH is too big to shoot down in one go"
+#endif
+
+/* Most clock victims vm_pageout looks at, dirty ones included. */
+#define VM_PAGEOUT_SCAN		(2 * VM_PAGEOUT_BATCH)
+
+/* Most vm_pageout rounds alloc_kpages tries before giving up. */
+#define VM_KPAGES_TRIES		16
+
+/* Set once page replacement can run (see vm_can_pageout). */
+static bool vm_ready = false;
+
+/*
+ * A frame of zeros, mapped copy-on-write (PTE_ZERO) wherever a page
+ * that would be zero-filled is read before it is written. It holds a
+ * reference nobody ever drops, so it is never freed, evicted or
+ * reused in place, and mapping it doesn't touch its reference count.
+ */
+static paddr_t vm_zeropage;
+
+/* Upper bound on every region's fault-around window. */
+static unsigned vm_faultaround_max = VM_FAULTAROUND_MAX;
+
+static unsigned vm_pageout(void);
+
+void
+vm_bootstrap(void)
+{
+	coremap_bootstrap();
+	vmstats_init();
+
+	vm_zeropage = coremap_alloc(1);
+	if (vm_zeropage == 0) {
+		panic("vm_bootstrap: out of memory\n");
+	}
+	bzero((void *)PADDR_TO_KVADDR(vm_zeropage), PAGE_SIZE);
+	coremap_incref(vm_zeropage);
+
+	swap_bootstrap();
+	pagezero_bootstrap();
+	vm_ready = true;
+}
+
+/*
+ * Whether alloc_kpages may evict pages to satisfy a request, which
+ * means sleeping on disk I/O. Not in interrupt handlers, and not with
+ * a spinlock held or interrupts otherwise off.
+ */
+static
+bool
+vm_can_pageout(void)
+{
+	return vm_ready && curthread != NULL &&
+		!curthread->t_in_interrupt && curthread->t_curspl == 0;
+}
+
+/* Allocate/free some kernel-space virtual pages */
+vaddr_t
+alloc_kpages(int npages)
+{
+	paddr_t pa;
+	int tries;
+
+	pa = coremap_alloc(npages);
+	if (pa == 0 && vm_can_pageout()) {
+		/*
+		 * Objects the caches keep for reuse are cheaper to give up
+		 * than anyone's pages, so let them go first; kmalloc frees
+		 * a page once everything on it has been freed.
+		 */
+		while (pa == 0 && kmem_cache_reapall() > 0) {
+			pa = coremap_alloc(npages);
+		}
+		for (tries = 0; pa == 0 && tries < VM_KPAGES_TRIES; tries++) {
+			if (vm_pageout() == 0) {
+				break;
+			}
+			pa = coremap_alloc(npages);
+		}
+	}
+	if (pa == 0) {
+		return 0;
+	}
+	return PADDR_TO_KVADDR(pa);
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+	KASSERT(addr >= MIPS_KSEG0 && addr < MIPS_KSEG1);
+	coremap_free(addr - MIPS_KSEG0);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Software TLB
+
+/* Slot for an EntryHi value; mixing in the PID spreads processes out. */
+#define STLB_INDEX(ehi) \
+	((((ehi) >> 12) ^ (((ehi) & TLBHI_PID) >> TLBHI_PIDSHIFT)) & \
+	 (CPU_STLB_SIZE - 1))
+
+void
+vm_stlb_flush(void)
+{
+	KASSERT(curthread->t_curspl > 0);
+	bzero(curcpu->c_stlb_lo, sizeof(curcpu->c_stlb_lo));
+}
+
+static
+void
+vm_stlb_insert(uint32_t ehi, uint32_t elo)
+{
+	unsigned i;
+
+	i = STLB_INDEX(ehi);
+	curcpu->c_stlb_hi[i] = ehi;
+	curcpu->c_stlb_lo[i] = elo;
+}
+
+static
+void
+vm_stlb_remove(uint32_t ehi)
+{
+	unsigned i;
+
+	i = STLB_INDEX(ehi);
+	if (curcpu->c_stlb_hi[i] == ehi) {
+		curcpu->c_stlb_lo[i] = 0;
+	}
+}
+
+void
+vm_tlbshootdown_all(void)
+{
+	int i, spl;
+
+	spl = splhigh();
+	for (i=0; i<NUM_TLB; i++) {
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	tlb_setpid(curcpu->c_tlbpid);
+	vm_stlb_flush();
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	uint32_t ehi;
+	int i, pid, spl;
+
+	spl = splhigh();
+	pid = as_tlbpid(ts->ts_addrspace);
+	if (pid >= 0) {
+		ehi = (ts->ts_vaddr & PAGE_FRAME) |
+			((uint32_t)pid << TLBHI_PIDSHIFT);
+		i = tlb_probe(ehi, 0);
+		if (i >= 0) {
+			tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+		}
+		tlb_setpid(curcpu->c_tlbpid);
+		vm_stlb_remove(ehi);
+	}
+	splx(spl);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Page replacement
+
+/*
+ * Shoot down the TLB entries for N victims, with one (synchronous)
+ * batch per address space.
+ */
+static
+void
+vm_pageout_shootdown(unsigned n, struct addrspace **ases, const vaddr_t *vaddrs)
+{
+	vaddr_t batch[VM_PAGEOUT_BATCH];
+	bool done[VM_PAGEOUT_BATCH];
+	unsigned i, j, k;
+
+	for (i = 0; i < n; i++) {
+		done[i] = false;
+	}
+	for (i = 0; i < n; i++) {
+		if (done[i]) {
+			continue;
+		}
+		k = 0;
+		for (j = i; j < n; j++) {
+			if (!done[j] && ases[j] == ases[i]) {
+				batch[k++] = vaddrs[j];
+				done[j] = true;
+			}
+		}
+		as_tlbshootdown(ases[i], batch, k, true);
+	}
+}
+
+/*
+ * Evict up to VM_PAGEOUT_BATCH pages, chosen by the clock, to swap.
+ * All the victims are picked first so they can be written out
+ * together, in as few disk requests as the swap slots allow. Pages
+ * from the page cache are never dirty, so those are just unmapped;
+ * the next fault reads them in again. Returns the number of frames
+ * freed.
+ *
+ * No locks are held, here or by the caller as far as we care: the
+ * victims are busy, which keeps their owners off their PTEs (and
+ * their address spaces from being destroyed) until we're done.
+ *
+ * Cached file pages nothing maps are cheaper to lose than any of
+ * those, so if the page cache can give up some frames, that's all.
+ *
+ * Pages of shared file mappings that haven't been written back yet
+ * can't go anywhere, so those victims are let go again.
+ */
+static
+unsigned
+vm_pageout(void)
+{
+	paddr_t pas[VM_PAGEOUT_BATCH], outpas[VM_PAGEOUT_BATCH];
+	unsigned slots[VM_PAGEOUT_BATCH];
+	pte_t *ptes[VM_PAGEOUT_BATCH];
+	struct addrspace *ases[VM_PAGEOUT_BATCH];
+	vaddr_t vaddrs[VM_PAGEOUT_BATCH];
+	struct addrspace *as;
+	vaddr_t vaddr;
+	paddr_t pa;
+	pte_t *pte;
+	unsigned i, j, n, nout, nfreed, nscan;
+	int result;
+
+	nfreed = pagecache_reclaim(VM_PAGEOUT_BATCH);
+	if (nfreed > 0) {
+		return nfreed;
+	}
+
+	nout = 0;
+	n = 0;
+	for (nscan = 0; n < VM_PAGEOUT_BATCH && nscan < VM_PAGEOUT_SCAN;
+	     nscan++) {
+		pa = coremap_clock_victim(&as, &vaddr);
+		if (pa == 0) {
+			break;
+		}
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		KASSERT(pte != NULL);
+		KASSERT((*pte & (PTE_VALID|PTE_FRAME)) == (PTE_VALID|pa));
+		KASSERT((*pte & PTE_SWAPPED) == 0);
+		if (*pte & PTE_DIRTY) {
+			coremap_unbusy(pa);
+			continue;
+		}
+		if ((*pte & PTE_PCACHE) == 0) {
+			if (swap_alloc(&slots[nout])) {
+				coremap_unbusy(pa);
+				break;
+			}
+			outpas[nout++] = pa;
+		}
+
+		ptes[n] = pte;
+		pas[n] = pa;
+		ases[n] = as;
+		vaddrs[n] = vaddr;
+		n++;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	/*
+	 * Make sure nobody can write them while they're going out. This
+	 * waits until every cpu has dropped the entries.
+	 */
+	vm_pageout_shootdown(n, ases, vaddrs);
+
+	result = nout > 0 ? swap_write(nout, outpas, slots) : 0;
+	if (result) {
+		kprintf("vm: pageout: %s\n", strerror(result));
+		for (i = 0; i < nout; i++) {
+			swap_decref(slots[i]);
+			coremap_unbusy(outpas[i]);
+		}
+	}
+
+	/* Change each PTE before the frame stops being busy. */
+	nfreed = 0;
+	for (i = 0, j = 0; i < n; i++) {
+		if (*ptes[i] & PTE_PCACHE) {
+			*ptes[i] = 0;
+			pagecache_release(pas[i]);
+		}
+		else if (result == 0) {
+			*ptes[i] = PTE_MKSWAPPED(slots[j++]);
+			coremap_decref(pas[i]);
+		}
+		else {
+			continue;
+		}
+		nfreed++;
+	}
+	return nfreed;
+}
+
+/*
+ * Get a frame for a user page, evicting something if necessary.
+ */
+static
+paddr_t
+vm_page_alloc(void)
+{
+	paddr_t pa;
+
+	pa = coremap_alloc(1);
+	if (pa == 0) {
+		/* Zeroed frames are as good as any. */
+		pa = pagezero_get();
+	}
+	while (pa == 0) {
+		if (vm_pageout() == 0) {
+			return 0;
+		}
+		pa = coremap_alloc(1);
+	}
+	return pa;
+}
+
+/*
+ * Bring the swapped-out page behind PTE back into memory.
+ */
+int
+vm_swapin(pte_t *pte)
+{
+	unsigned slot;
+	paddr_t pa;
+	int result;
+
+	KASSERT(*pte & PTE_SWAPPED);
+
+	slot = PTE_SLOT(*pte);
+	pa = vm_page_alloc();
+	if (pa == 0) {
+		return ENOMEM;
+	}
+	result = swap_read(slot, pa);
+	if (result) {
+		coremap_free(pa);
+		return result;
+	}
+	/* Other page tables may still refer to the slot after fork. */
+	swap_decref(slot);
+	*pte = pa | PTE_VALID;
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Faults
+
+/*
+ * Fill the frame at PA with the page at VADDR of region VR, reading
+ * whatever part of it is backed by the region's file. Returns -1 if
+ * no part of the page comes from the file, so the caller can count it
+ * as a zero-fill fault. An mmap'd file may end anywhere in the region;
+ * the rest of the page reads as zeros.
+ */
+static
+int
+vm_file_fill(struct vm_region *vr, vaddr_t vaddr, paddr_t pa)
+{
+	struct iovec iov;
+	struct uio ku;
+	vaddr_t start, end;
+	char *kva;
+	int result;
+
+	kva = (char *)PADDR_TO_KVADDR(pa);
+	bzero(kva, PAGE_SIZE);
+
+	if (vr->vr_vnode == NULL) {
+		return -1;
+	}
+	start = vr->vr_fileva > vaddr ? vr->vr_fileva : vaddr;
+	end = vr->vr_fileva + vr->vr_filesize;
+	if (end > vaddr + PAGE_SIZE) {
+		end = vaddr + PAGE_SIZE;
+	}
+	if (start >= end) {
+		return -1;
+	}
+
+	uio_kinit(&iov, &ku, kva + (start - vaddr), end - start,
+		  vr->vr_offset + (start - vr->vr_fileva), UIO_READ);
+	result = VOP_READ(vr->vr_vnode, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid != 0 && (vr->vr_flags & VR_MMAP) == 0) {
+		kprintf("vm: short read on ELF page 0x%x - file truncated?\n",
+			vaddr);
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Get the frame holding the page of VR's file at OFFSET from the file
+ * system, to map as it is, with a reference for the PTE. Drops
+ * as_lock around the file system call, as vm_fault_locked does for
+ * vm_file_fill.
+ */
+static
+int
+vm_file_getpage(struct addrspace *as, struct vm_region *vr, off_t offset,
+		paddr_t *ret)
+{
+	int result;
+
+	lock_release(&as->as_lock);
+	result = VOP_MMAP(vr->vr_vnode, offset, ret);
+	lock_acquire(&as->as_lock);
+	return result;
+}
+
+/*
+ * Load a translation into the TLB, using a free slot if there is one
+ * and a random victim otherwise. If the TLB already has an entry for
+ * VADDR (a write to a read-only mapping), it is replaced in place.
+ * The entry is tagged with the current address space's PID.
+ *
+ * Fault-around uses this with PRELOAD set, which leaves an existing
+ * entry alone and keeps the load out of the TLB fault statistics.
+ *
+ * The translation goes into the software TLB as well.
+ */
+static
+void
+vm_tlb_load(vaddr_t vaddr, paddr_t paddr, bool writeable, bool preload)
+{
+	uint32_t ehi, elo, pid;
+	int i, spl;
+
+	elo = paddr | TLBLO_VALID;
+	if (writeable) {
+		elo |= TLBLO_DIRTY;
+	}
+
+	/* Disable interrupts on this CPU while frobbing the TLB. */
+	spl = splhigh();
+
+	pid = curcpu->c_tlbpid;
+	ehi = vaddr | (pid << TLBHI_PIDSHIFT);
+	vm_stlb_insert(ehi, elo);
+
+	i = tlb_probe(ehi, 0);
+	if (i >= 0) {
+		if (!preload) {
+			tlb_write(ehi, elo, i);
+		}
+		splx(spl);
+		return;
+	}
+
+	for (i=0; i<NUM_TLB; i++) {
+		uint32_t oldhi, oldlo;
+
+		tlb_read(&oldhi, &oldlo, i);
+		if (oldlo & TLBLO_VALID) {
+			continue;
+		}
+		tlb_write(ehi, elo, i);
+		if (!preload) {
+			_vmstats_inc(VMSTAT_TLB_FAULT_FREE);
+		}
+		splx(spl);
+		return;
+	}
+
+	/* tlb_read changed EntryHi, but this puts it back. */
+	tlb_random(ehi, elo);
+	if (!preload) {
+		_vmstats_inc(VMSTAT_TLB_FAULT_REPLACE);
+	}
+	splx(spl);
+}
+
+/*
+ * Try to refill the TLB from the software TLB after a miss on VADDR.
+ * Returns true if that worked. The caller must already have checked
+ * that VADDR's region allows the access.
+ */
+static
+bool
+vm_stlb_reload(struct addrspace *as, int faulttype, vaddr_t vaddr)
+{
+	uint32_t ehi, elo;
+	unsigned i;
+	bool hit;
+	int spl;
+
+	/*
+	 * With interrupts off no shootdown can get in between the
+	 * lookup and the TLB load, so the entry can't go stale.
+	 */
+	spl = splhigh();
+
+	ehi = vaddr | (curcpu->c_tlbpid << TLBHI_PIDSHIFT);
+	i = STLB_INDEX(ehi);
+	elo = curcpu->c_stlb_lo[i];
+	hit = curcpu->c_stlb_hi[i] == ehi && (elo & TLBLO_VALID) != 0 &&
+		(faulttype == VM_FAULT_READ || (elo & TLBLO_DIRTY) != 0);
+	if (hit) {
+		_vmstats_inc(VMSTAT_TLB_FAULT);
+		_vmstats_inc(VMSTAT_TLB_RELOAD);
+		coremap_touch(elo & TLBLO_PPAGE, as, vaddr);
+		vm_tlb_load(vaddr, elo & TLBLO_PPAGE,
+			    (elo & TLBLO_DIRTY) != 0, false);
+	}
+
+	splx(spl);
+	return hit;
+}
+
+void
+vm_set_faultaround(unsigned npages)
+{
+	if (npages > VM_FAULTAROUND_MAX) {
+		npages = VM_FAULTAROUND_MAX;
+	}
+	vm_faultaround_max = npages;
+}
+
+unsigned
+vm_get_faultaround(void)
+{
+	return vm_faultaround_max;
+}
+
+/*
+ * Whether the TLB entry for a page with PTE may allow writes (if its
+ * region does): not for copy-on-write pages, nor for page cache pages
+ * of shared mappings until their first write has marked them dirty.
+ */
+static
+bool
+vm_pte_writeable(pte_t pte, bool writeable)
+{
+	return writeable && (pte & PTE_COW) == 0 &&
+		((pte & PTE_PCACHE) == 0 || (pte & PTE_DIRTY) != 0);
+}
+
+/*
+ * Note a write to the page behind PTE, if it's a page cache page of
+ * a shared file mapping, which will then need writing back.
+ */
+static
+void
+vm_pte_written(pte_t *pte)
+{
+	if ((*pte & (PTE_PCACHE|PTE_COW)) == PTE_PCACHE) {
+		*pte |= PTE_DIRTY;
+	}
+}
+
+/*
+ * Judge VR's last fault-around window by the miss at FAULTADDRESS
+ * and resize the window accordingly.
+ */
+static
+void
+vm_faultaround_feedback(struct vm_region *vr, vaddr_t faultaddress)
+{
+	unsigned hits, misses, i;
+
+	if (vr->vr_fa_start == vr->vr_fa_end) {
+		return;
+	}
+
+	if (faultaddress >= vr->vr_fa_start &&
+	    faultaddress <= vr->vr_fa_end) {
+		hits = (faultaddress - vr->vr_fa_start) / PAGE_SIZE;
+		misses = (vr->vr_fa_end - faultaddress) / PAGE_SIZE;
+	}
+	else {
+		hits = 0;
+		misses = (vr->vr_fa_end - vr->vr_fa_start) / PAGE_SIZE;
+	}
+	vr->vr_fa_start = vr->vr_fa_end = 0;
+
+	for (i=0; i<hits; i++) {
+		vmstats_inc(VMSTAT_PRELOAD_HIT);
+	}
+	for (i=0; i<misses; i++) {
+		vmstats_inc(VMSTAT_PRELOAD_MISS);
+	}
+
+	if (misses == 0) {
+		if (vr->vr_fa_window < VM_FAULTAROUND_MAX) {
+			vr->vr_fa_window *= 2;
+		}
+	}
+	else if (hits < misses && vr->vr_fa_window > 1) {
+		vr->vr_fa_window /= 2;
+	}
+}
+
+/*
+ * Preload TLB entries for the resident pages following FAULTADDRESS
+ * in VR, stopping at the first one that isn't resident, and remember
+ * which ones they were.
+ */
+static
+void
+vm_faultaround(struct addrspace *as, struct vm_region *vr,
+	       vaddr_t faultaddress, bool writeable)
+{
+	vaddr_t va, top;
+	unsigned n, i;
+	pte_t *pte;
+	bool ok;
+	int spl;
+
+	n = vr->vr_fa_window;
+	if (n > vm_faultaround_max) {
+		n = vm_faultaround_max;
+	}
+	top = vr->vr_base + vr->vr_npages * PAGE_SIZE;
+
+	va = faultaddress + PAGE_SIZE;
+	for (i=0; i<n && va < top; i++, va += PAGE_SIZE) {
+		pte = pt_lookup(as->as_pt, va, false);
+		if (pte == NULL) {
+			break;
+		}
+
+		/*
+		 * These pages aren't pinned. Page replacement marks a
+		 * victim busy before shooting it down, and with
+		 * interrupts off the shootdown can't get in between the
+		 * check and the load, so a page that isn't busy yet will
+		 * lose its entry again if it's evicted.
+		 */
+		spl = splhigh();
+		ok = (*pte & PTE_VALID) != 0 &&
+			!coremap_busy(*pte & PTE_FRAME);
+		if (ok) {
+			/* as for the faulting page, so the clock sees it */
+			coremap_touch(*pte & PTE_FRAME, as, va);
+			vm_tlb_load(va, *pte & PTE_FRAME,
+				    vm_pte_writeable(*pte, writeable),
+				    true);
+		}
+		splx(spl);
+		if (!ok) {
+			break;
+		}
+	}
+
+	vr->vr_fa_start = faultaddress + PAGE_SIZE;
+	vr->vr_fa_end = va;
+}
+
+/*
+ * Can the page at VADDR of VR be shared through the page cache? It
+ * can if VR is a read-only part of an executable, or a file mapping,
+ * and the file covers all of the page. If so, return the file offset
+ * of the page in OFFSET.
+ */
+static
+bool
+vm_page_cacheable(struct vm_region *vr, vaddr_t vaddr, off_t *offset)
+{
+	*offset = VR_FILEOFF(vr, vaddr);
+
+	if (vr->vr_vnode == NULL ||
+	    (vr->vr_flags & (VR_WRITE|VR_MMAP)) == VR_WRITE) {
+		return false;
+	}
+	if (vaddr < vr->vr_fileva ||
+	    vaddr + PAGE_SIZE > vr->vr_fileva + vr->vr_filesize) {
+		return false;
+	}
+	return *offset % PAGE_SIZE == 0;
+}
+
+/*
+ * Does any part of the page at VADDR of VR come from VR's file?
+ */
+static
+bool
+vm_page_hasfile(struct vm_region *vr, vaddr_t vaddr)
+{
+	return vr->vr_vnode != NULL &&
+		vaddr < vr->vr_fileva + vr->vr_filesize &&
+		vaddr + PAGE_SIZE > vr->vr_fileva;
+}
+
+/*
+ * Pin the frame behind PTE (see coremap_pin) and return it, or return
+ * 0 if the page isn't resident. The zero page is never evicted, so it
+ * doesn't need pinning.
+ */
+static
+paddr_t
+vm_pin(pte_t *pte)
+{
+	if (*pte & PTE_ZERO) {
+		return vm_zeropage;
+	}
+	return coremap_pin(pte);
+}
+
+static
+void
+vm_unpin(paddr_t pa)
+{
+	if (pa != vm_zeropage) {
+		coremap_unbusy(pa);
+	}
+}
+
+/*
+ * Give the page AS maps at VADDR, behind PTE, a frame of its own so it
+ * can be written. The frame PTE maps must be pinned, and whatever it
+ * maps afterwards is.
+ */
+static
+int
+vm_cow_break(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+	paddr_t oldpa, newpa;
+	bool zero, pcache;
+
+	KASSERT(*pte & PTE_VALID);
+	KASSERT(*pte & PTE_COW);
+
+	oldpa = *pte & PTE_FRAME;
+	zero = (*pte & PTE_ZERO) != 0;
+	pcache = (*pte & PTE_PCACHE) != 0;
+	if (zero) {
+		/* Only ever read so far; no need to copy the zeros. */
+		newpa = pagezero_get();
+		if (newpa == 0) {
+			newpa = vm_page_alloc();
+			if (newpa == 0) {
+				return ENOMEM;
+			}
+			bzero((void *)PADDR_TO_KVADDR(newpa), PAGE_SIZE);
+		}
+	}
+	else if (coremap_refcount(oldpa) == 1) {
+		/*
+		 * Everyone else has let go already, the page cache
+		 * included if it's a file page.
+		 */
+		*pte &= ~(pte_t)(PTE_COW|PTE_PCACHE);
+		vmstats_inc(VMSTAT_COW_REUSE);
+		return 0;
+	}
+	else {
+		newpa = vm_page_alloc();
+		if (newpa == 0) {
+			return ENOMEM;
+		}
+		memmove((void *)PADDR_TO_KVADDR(newpa),
+			(const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+	}
+
+	/*
+	 * Other cpus the process has run on may still map the old
+	 * frame, and would go on reading it (even the zero page: the
+	 * page wouldn't read as zeros any more). Only cpus using AS
+	 * right now get an IPI.
+	 */
+	as_tlbshootdown(as, &vaddr, 1, true);
+
+	*pte = newpa | PTE_VALID;
+	if (pcache) {
+		pagecache_release_busy(oldpa);
+	}
+	else if (!zero) {
+		coremap_decref_busy(oldpa);
+	}
+	/* Nobody else knows about the new frame, so this can't wait. */
+	coremap_pin(pte);
+	/* Nothing was copied for the zero page; it's a deferred zero fill. */
+	vmstats_inc(zero ? VMSTAT_ZERO_BREAK : VMSTAT_COW_COPY);
+	return 0;
+}
+
+/*
+ * Map PA, the page cache's frame for the page of VR's file at OFFSET,
+ * with PTE: copy-on-write if VR is a private writable mapping, and
+ * counted as a shared mapping if VR is shared. (If the cache has let
+ * go of the frame since, a shared mapping gets it to itself. Writes
+ * to it still get written back, just not seen by read until then.)
+ */
+static
+void
+vm_map_pcache(struct vm_region *vr, off_t offset, pte_t *pte, paddr_t pa)
+{
+	*pte = pa | PTE_VALID | PTE_PCACHE;
+	if (vr->vr_flags & VR_SHARED) {
+		pagecache_share(vr->vr_vnode, offset, pa);
+	}
+	else if (vr->vr_flags & VR_WRITE) {
+		*pte |= PTE_COW;
+	}
+}
+
+/*
+ * The part of vm_fault that runs with AS's as_lock held.
+ */
+static
+int
+vm_fault_locked(struct addrspace *as, struct vm_region *vr, int faulttype,
+		vaddr_t faultaddress, bool writeable)
+{
+	pte_t *pte;
+	paddr_t pa, pinned;
+	off_t offset;
+	bool cacheable, shared;
+	int result;
+
+	if (faulttype == VM_FAULT_READONLY) {
+		pte = pt_lookup(as->as_pt, faultaddress, false);
+		if (pte == NULL) {
+			return EFAULT;
+		}
+		pinned = vm_pin(pte);
+		if (pinned != 0) {
+			/* Write to a copy-on-write page that's in the TLB. */
+			if (*pte & PTE_COW) {
+				result = vm_cow_break(as, faultaddress, pte);
+				if (result) {
+					vm_unpin(pinned);
+					return result;
+				}
+			}
+			/*
+			 * Otherwise it's the first write to a shared file
+			 * page, or the entry is just stale, left on this
+			 * cpu from before the page was made writable.
+			 */
+			vm_pte_written(pte);
+			pa = *pte & PTE_FRAME;
+			coremap_touch(pa, as, faultaddress);
+			vm_tlb_load(faultaddress, pa, true, false);
+			vm_unpin(pa);
+			return 0;
+		}
+		/* Evicted since it was loaded; treat as a write miss. */
+		faulttype = VM_FAULT_WRITE;
+	}
+
+	vmstats_inc(VMSTAT_TLB_FAULT);
+	vm_faultaround_feedback(vr, faultaddress);
+	cacheable = vm_page_cacheable(vr, faultaddress, &offset);
+	shared = (vr->vr_flags & VR_SHARED) != 0 && vr->vr_vnode != NULL;
+	if (faulttype == VM_FAULT_WRITE && !shared) {
+		/* It would be copied at once; just read in a copy. */
+		cacheable = false;
+	}
+
+	pte = pt_lookup(as->as_pt, faultaddress, true);
+	if (pte == NULL) {
+		return ENOMEM;
+	}
+
+	pinned = vm_pin(pte);
+	if (pinned != 0) {
+		vmstats_inc(VMSTAT_TLB_RELOAD);
+		if ((*pte & PTE_COW) && faulttype == VM_FAULT_WRITE) {
+			result = vm_cow_break(as, faultaddress, pte);
+			if (result) {
+				vm_unpin(pinned);
+				return result;
+			}
+			pinned = *pte & PTE_FRAME;
+		}
+	}
+	else if (*pte & PTE_SWAPPED) {
+		result = vm_swapin(pte);
+		if (result) {
+			return result;
+		}
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+	}
+	else if (cacheable &&
+		 (pa = pagecache_get(vr->vr_vnode, offset)) != 0) {
+		/* Someone ran this program or used this file recently. */
+		vm_map_pcache(vr, offset, pte, pa);
+		vmstats_inc(VMSTAT_PAGECACHE_HIT);
+	}
+	else if (cacheable &&
+		 (result = vm_file_getpage(as, vr, offset, &pa)) == 0) {
+		/* The file system read it into its cache; map that. */
+		KASSERT(*pte == 0);
+		vm_map_pcache(vr, offset, pte, pa);
+		vmstats_inc(VMSTAT_PAGECACHE_MISS);
+		vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+		vmstats_inc(VMSTAT_ELF_FILE_READ);
+	}
+	else if (cacheable && shared) {
+		/* A private copy wouldn't be shared with anything. */
+		return result;
+	}
+	else if (faulttype == VM_FAULT_READ &&
+		 (vr->vr_flags & VR_SHARED) == 0 &&
+		 !vm_page_hasfile(vr, faultaddress)) {
+		/* Read before write: map the zero page until written. */
+		*pte = vm_zeropage | PTE_VALID | PTE_COW | PTE_ZERO;
+		vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+	}
+	else {
+		/* First touch: zero-fill it or read it from the file. */
+		if (vm_page_hasfile(vr, faultaddress)) {
+			pa = vm_page_alloc();
+			if (pa == 0) {
+				return ENOMEM;
+			}
+
+			/*
+			 * Don't hold as_lock across file system I/O: a
+			 * thread in the file system, holding its locks,
+			 * may be faulting on this address space in
+			 * uiomove. Nothing else can map this page
+			 * meanwhile, and the frame can't be evicted until
+			 * it has been touched.
+			 */
+			lock_release(&as->as_lock);
+			result = vm_file_fill(vr, faultaddress, pa);
+			lock_acquire(&as->as_lock);
+		}
+		else {
+			/* Use one the zeroing thread prepared, if we can. */
+			pa = pagezero_get();
+			if (pa == 0) {
+				pa = vm_page_alloc();
+				if (pa == 0) {
+					return ENOMEM;
+				}
+				bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+			}
+			result = -1;
+		}
+
+		if (result > 0) {
+			coremap_free(pa);
+			return result;
+		}
+		KASSERT(*pte == 0);
+		*pte = pa | PTE_VALID;
+		if (result == 0) {
+			vmstats_inc(VMSTAT_PAGE_FAULT_DISK);
+			vmstats_inc(VMSTAT_ELF_FILE_READ);
+		}
+		else {
+			vmstats_inc(VMSTAT_PAGE_FAULT_ZERO);
+		}
+	}
+
+	if (pinned == 0) {
+		/* Keep what we just mapped until it's in the TLB. */
+		pinned = vm_pin(pte);
+		KASSERT(pinned != 0);
+	}
+
+	if (faulttype == VM_FAULT_WRITE) {
+		vm_pte_written(pte);
+	}
+	pa = *pte & PTE_FRAME;
+	KASSERT(pa == pinned);
+	coremap_touch(pa, as, faultaddress);
+
+	/* Preload first, so the random replacement can't evict this one. */
+	vm_faultaround(as, vr, faultaddress, writeable);
+	vm_tlb_load(faultaddress, pa, vm_pte_writeable(*pte, writeable),
+		    false);
+	vm_unpin(pa);
+	return 0;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+	struct addrspace *as;
+	struct vm_region *vr;
+	bool writeable;
+	int result;
+
+	faultaddress &= PAGE_FRAME;
+
+	DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+	switch (faulttype) {
+	    case VM_FAULT_READONLY:
+	    case VM_FAULT_READ:
+	    case VM_FAULT_WRITE:
+		break;
+	    default:
+		return EINVAL;
+	}
+
+	if (curproc == NULL) {
+		/*
+		 * No process. This is probably a kernel fault early
+		 * in boot. Return EFAULT so as to panic instead of
+		 * getting into an infinite faulting loop.
+		 */
+		return EFAULT;
+	}
+
+	as = curproc_getas();
+	if (as == NULL) {
+		/*
+		 * No address space set up. This is probably also a
+		 * kernel fault early in boot.
+		 */
+		return EFAULT;
+	}
+
+	if (faultaddress >= USERSPACETOP) {
+		return EFAULT;
+	}
+
+	vr = as_find_region(as, faultaddress);
+	if (vr == NULL) {
+		/* Maybe the stack needs to grow. */
+		vr = as_growstack(as, faultaddress,
+				  curthread->t_machdep.tm_usersp);
+		if (vr == NULL) {
+			return EFAULT;
+		}
+	}
+	if ((vr->vr_flags & (VR_READ | VR_EXEC)) == 0) {
+		/*
+		 * No access at all (PROT_NONE). The TLB can't tell
+		 * execute from read, so executable pages stay readable.
+		 */
+		return EFAULT;
+	}
+	writeable = (vr->vr_flags & VR_WRITE) != 0;
+	if (faulttype != VM_FAULT_READ && !writeable) {
+		/* Write to a page of a read-only region. */
+		return EFAULT;
+	}
+
+	/* Only after the checks, so no entry outlives its permissions. */
+	if (faulttype != VM_FAULT_READONLY &&
+	    vm_stlb_reload(as, faulttype, faultaddress)) {
+		return 0;
+	}
+
+	lock_acquire(&as->as_lock);
+	result = vm_fault_locked(as, vr, faulttype, faultaddress, writeable);
+	lock_release(&as->as_lock);
+
+	return result;
+}
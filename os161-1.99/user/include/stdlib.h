@@ -69,5 +69,6 @@ char *setstate(char *);
  */
 void *malloc(size_t size);
 void free(void *ptr);
+void *realloc(void *ptr, size_t size);
 
 #endif /* _STDLIB_H_ */
@@ -30,115 +30,125 @@
 /*
  * User-level malloc and free implementation.
  *
- * This is a basic first-fit allocator. It's intended to be simple and
- * easy to follow. It performs abysmally if the heap becomes larger than
- * physical memory. To get (much) better out-of-core performance, port
- * the kernel's malloc. :-)
+ * The heap is managed in pages. Small requests (up to MSMALLMAX
+ * bytes) are rounded up to one of a handful of size classes and
+ * carved out of pages given over to that class; each such page keeps
+ * its own list of free blocks, and each class keeps a list of its
+ * pages that have any free blocks, so allocating and freeing a small
+ * block is O(1). Larger requests get a span of whole pages.
+ *
+ * Every page or span starts with a struct mpage header, so free()
+ * finds the header of any block by rounding the pointer down to a
+ * page boundary. (That's why large blocks get a span of their own.)
+ *
+ * Free spans, including small-block pages that have become entirely
+ * free, are kept in address order and merged with their neighbours.
+ * (Except that each class keeps its last page even when it's empty.)
+ * When the free space at the top of the heap gets to be MTRIMPAGES
+ * pages or more, it is handed back to the kernel with sbrk.
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <err.h>
 #include <stdint.h>  // for uintptr_t on non-OS/161 platforms
 
 #undef MALLOCDEBUG
 
-#if defined(__mips__) || defined(__i386__)
-#define MALLOC32
-#elif defined(__alpha__)
-#define MALLOC64
-#else
-#error "please fix me"
-#endif
-
 /*
- * malloc block header.
+ * Sizes.
  *
- * mh_prevblock is the downwards offset to the previous header, 0 if this
- * is the bottom of the heap.
+ * MPAGESIZE is the unit the heap is managed in. It must be a power of
+ * 2, and it's best if it's the VM page size.
  *
- * mh_nextblock is the upwards offset to the next header.
+ * MALIGN is the alignment of every block handed out.
  *
- * mh_pad is unused.
- * mh_inuse is 1 if the block is in use, 0 if it is free.
- * mh_magic* should always be a fixed value.
+ * MSMALLMAX is the biggest request served from a size class.
  *
- * MBLOCKSIZE should equal sizeof(struct mheader) and be a power of 2.
- * MBLOCKSHIFT is the log base 2 of MBLOCKSIZE.
- * MMAGIC is the value for mh_magic*.
+ * MTRIMPAGES is how much free space at the top of the heap is
+ * tolerated before giving it back.
  */
-struct mheader {
-
-#if defined(MALLOC32)
-#define MBLOCKSIZE 8
-#define MBLOCKSHIFT 3
-#define MMAGIC 2
-	/*
-	 * 32-bit platform. size_t is 32 bits (4 bytes). 
-	 * Block size is 8 bytes.
-	 */
-	unsigned mh_prevblock:29;
-	unsigned mh_pad:1;
-	unsigned mh_magic1:2;
-
-	unsigned mh_nextblock:29;
-	unsigned mh_inuse:1;
-	unsigned mh_magic2:2;
-
-#elif defined(MALLOC64)
-#define MBLOCKSIZE 16
-#define MBLOCKSHIFT 4
-#define MMAGIC 6
-	/*
-	 * 64-bit platform. size_t is 64 bits (8 bytes)
-	 * Block size is 16 bytes.
-	 */
-	unsigned mh_prevblock:62;
-	unsigned mh_pad:1;
-	unsigned mh_magic1:3;
-
-	unsigned mh_nextblock:62;
-	unsigned mh_inuse:1;
-	unsigned mh_magic2:3;
-
-#else
-#error "please fix me"
-#endif
-};
+#define MPAGESIZE	4096
+#define MALIGN		16
+#define MSMALLMAX	1008
+#define MTRIMPAGES	4
 
 /*
- * Operator macros on struct mheader.
+ * Page/span header.
  *
- * M_NEXT/PREVOFF:	return offset to next/previous header
- * M_NEXT/PREV:		return next/previous header
- * 
- * M_DATA:		return data pointer of a header
- * M_SIZE:		return data size of a header
+ * mp_magic says what the span is: a page of small blocks, a large
+ * block, or free.
  *
- * M_OK:		true if the magic values are correct
- * 
- * M_MKFIELD:		prepare a value for mh_next/prevblock.
- * 			(value should include the header size)
+ * mp_npages is the length of the span in pages (always 1 for a page
+ * of small blocks).
+ *
+ * For small-block pages, mp_class is the size class, mp_nfree the
+ * number of free blocks in the page, and mp_freelist the first of
+ * them; each free block holds a pointer to the next.
+ *
+ * mp_next/mp_prev link small-block pages with free blocks on their
+ * class's list, and free spans on the free span list.
  */
+struct mpage {
+	uint32_t mp_magic;
+	uint32_t mp_npages;
+	uint16_t mp_class;
+	uint16_t mp_nfree;
+	void *mp_freelist;
+	struct mpage *mp_next;
+	struct mpage *mp_prev;
+};
 
-#define M_NEXTOFF(mh)	((size_t)(((size_t)((mh)->mh_nextblock))<<MBLOCKSHIFT))
-#define M_PREVOFF(mh)	((size_t)(((size_t)((mh)->mh_prevblock))<<MBLOCKSHIFT))
-#define M_NEXT(mh)	((struct mheader *)(((char*)(mh))+M_NEXTOFF(mh)))
-#define M_PREV(mh)	((struct mheader *)(((char*)(mh))-M_PREVOFF(mh)))
+#define MMAGIC_SMALL	0x5ea11b0c
+#define MMAGIC_LARGE	0x1a26eb0c
+#define MMAGIC_FREE	0xf2eeb0c5
 
-#define M_DATA(mh)	((void *)((mh)+1))
-#define M_SIZE(mh)	(M_NEXTOFF(mh)-MBLOCKSIZE)
+/* Space taken by the header, keeping the blocks after it aligned. */
+#define MHDRSIZE	((sizeof(struct mpage) + MALIGN - 1) & ~(size_t)(MALIGN - 1))
 
-#define M_OK(mh)	((mh)->mh_magic1==MMAGIC && (mh)->mh_magic2==MMAGIC)
+/*
+ * Operator macros.
+ *
+ * M_PAGE:		header of the page a block is in
+ * M_END:		address just past a span
+ * M_FIRST:		first block of a page or span
+ */
+#define M_PAGE(ptr)	((struct mpage *)((uintptr_t)(ptr) & ~(uintptr_t)(MPAGESIZE - 1)))
+#define M_END(mp)	((uintptr_t)(mp) + (uintptr_t)(mp)->mp_npages * MPAGESIZE)
+#define M_FIRST(mp)	((void *)((char *)(mp) + MHDRSIZE))
 
-#define M_MKFIELD(off)	((off)>>MBLOCKSHIFT)
+/*
+ * The size classes. Each one is a multiple of MALIGN, and they're
+ * chosen so that a page holds a whole number of blocks with little
+ * left over.
+ */
+static const size_t __malloc_sizes[] = {
+	16, 32, 48, 64, 96, 128, 192, 256, 336, 448, 672, MSMALLMAX,
+};
+#define MNCLASSES	(sizeof(__malloc_sizes) / sizeof(__malloc_sizes[0]))
+
+/* Blocks of a class that fit in a page. */
+#define M_PERPAGE(c)	((MPAGESIZE - MHDRSIZE) / __malloc_sizes[c])
 
 ////////////////////////////////////////////////////////////
 
 /*
- * Static variables - the bottom and top addresses of the heap.
+ * Static variables.
+ *
+ * __heapbase and __heaptop are the bottom and top of the heap.
+ *
+ * __malloc_classof maps a request size, in units of MALIGN rounded
+ * up, to its size class.
+ *
+ * __malloc_partial[c] lists the pages of class c with free blocks.
+ *
+ * __malloc_freespans lists the free spans, in address order.
  */
 static uintptr_t __heapbase, __heaptop;
+static unsigned char __malloc_classof[MSMALLMAX / MALIGN + 1];
+static struct mpage *__malloc_partial[MNCLASSES];
+static struct mpage *__malloc_freespans;
 
 /*
  * Setup function.
@@ -148,18 +158,17 @@ void
 __malloc_init(void)
 {
 	void *x;
+	unsigned c, i;
 
 	/*
 	 * Check various assumed properties of the sizes.
 	 */
-	if (sizeof(struct mheader) != MBLOCKSIZE) {
-		errx(1, "malloc: Internal error - MBLOCKSIZE wrong");
-	}
-	if ((MBLOCKSIZE & (MBLOCKSIZE-1))!=0) {
-		errx(1, "malloc: Internal error - MBLOCKSIZE not power of 2");
+	if ((MPAGESIZE & (MPAGESIZE-1)) != 0) {
+		errx(1, "malloc: Internal error - MPAGESIZE not power of 2");
 	}
-	if (1<<MBLOCKSHIFT != MBLOCKSIZE) {
-		errx(1, "malloc: Internal error - MBLOCKSHIFT wrong");
+	if (__malloc_sizes[MNCLASSES-1] != MSMALLMAX ||
+	    M_PERPAGE(MNCLASSES-1) < 2) {
+		errx(1, "malloc: Internal error - MSMALLMAX wrong");
 	}
 
 	/* init should only be called once. */
@@ -167,6 +176,15 @@ __malloc_init(void)
 		errx(1, "malloc: Internal error - bad init call");
 	}
 
+	/* Build the size-to-class table. */
+	c = 0;
+	for (i=0; i<=MSMALLMAX / MALIGN; i++) {
+		while (__malloc_sizes[c] < i * MALIGN) {
+			c++;
+		}
+		__malloc_classof[i] = c;
+	}
+
 	/* Use sbrk to find the base of the heap. */
 	x = sbrk(0);
 	if (x==(void *)-1) {
@@ -178,14 +196,14 @@ __malloc_init(void)
 	__heapbase = __heaptop = (uintptr_t)x;
 
 	/*
-	 * Make sure the heap base is aligned the way we want it.
-	 * (On OS/161, it will begin on a page boundary. But on 
-	 * an arbitrary Unix, it may not be, as traditionally it
+	 * Make sure the heap base is page aligned, as finding headers
+	 * depends on it. (On OS/161, it will begin on a page boundary.
+	 * But on an arbitrary Unix, it may not be, as traditionally it
 	 * begins at _end.)
 	 */
 
-	if (__heapbase % MBLOCKSIZE != 0) {
-		size_t adjust = MBLOCKSIZE - (__heapbase % MBLOCKSIZE);
+	if (__heapbase % MPAGESIZE != 0) {
+		size_t adjust = MPAGESIZE - (__heapbase % MPAGESIZE);
 		x = sbrk(adjust);
 		if (x==(void *)-1) {
 			err(1, "malloc: sbrk failed aligning heap base");
@@ -204,47 +222,82 @@ __malloc_init(void)
 
 ////////////////////////////////////////////////////////////
 
+/*
+ * List functions. Both kinds of list are doubly linked through
+ * mp_next/mp_prev and null-terminated at each end.
+ */
+static
+void
+__malloc_unlink(struct mpage **head, struct mpage *mp)
+{
+	if (mp->mp_prev != NULL) {
+		mp->mp_prev->mp_next = mp->mp_next;
+	}
+	else {
+		*head = mp->mp_next;
+	}
+	if (mp->mp_next != NULL) {
+		mp->mp_next->mp_prev = mp->mp_prev;
+	}
+	mp->mp_next = mp->mp_prev = NULL;
+}
+
+static
+void
+__malloc_push(struct mpage **head, struct mpage *mp)
+{
+	mp->mp_prev = NULL;
+	mp->mp_next = *head;
+	if (*head != NULL) {
+		(*head)->mp_prev = mp;
+	}
+	*head = mp;
+}
+
 #ifdef MALLOCDEBUG
 
 /*
- * Debugging print function to iterate and dump the entire heap.
+ * Debugging print function to dump the free span list and the size
+ * classes.
  */
 static
 void
 __malloc_dump(void)
 {
-	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
+	struct mpage *mp;
+	uintptr_t prevend;
+	unsigned c;
 
 	warnx("heap: ************************************************");
-
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
+	warnx("heap: 0x%lx - 0x%lx",
+	      (unsigned long) __heapbase, (unsigned long) __heaptop);
+
+	prevend = 0;
+	for (mp = __malloc_freespans; mp != NULL; mp = mp->mp_next) {
+		if (mp->mp_magic != MMAGIC_FREE) {
+			errx(1, "malloc: Heap corrupt; free span at %p"
+			     " has bad magic", mp);
 		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i, 
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
+		if ((uintptr_t)mp <= prevend || M_END(mp) > __heaptop) {
+			errx(1, "malloc: Heap corrupt; free span at %p"
+			     " out of order or out of range", mp);
 		}
-		rightprevblock = mh->mh_nextblock;
-
-		warnx("heap: 0x%lx 0x%-6lx (next: 0x%lx) %s",
-		      (unsigned long) i + MBLOCKSIZE,
-		      (unsigned long) M_SIZE(mh),
-		      (unsigned long) (i+M_NEXTOFF(mh)),
-		      mh->mh_inuse ? "INUSE" : "FREE");
+		prevend = M_END(mp);
+		warnx("heap: free %p, %lu pages", mp,
+		      (unsigned long) mp->mp_npages);
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+
+	for (c=0; c<MNCLASSES; c++) {
+		for (mp = __malloc_partial[c]; mp != NULL; mp = mp->mp_next) {
+			if (mp->mp_magic != MMAGIC_SMALL ||
+			    mp->mp_class != c) {
+				errx(1, "malloc: Heap corrupt; page %p"
+				     " on class %u list is bad", mp, c);
+			}
+			warnx("heap: class %lu page %p, %u free",
+			      (unsigned long) __malloc_sizes[c], mp,
+			      mp->mp_nfree);
+		}
 	}
 
 	warnx("heap: ************************************************");
@@ -255,18 +308,18 @@ __malloc_dump(void)
 ////////////////////////////////////////////////////////////
 
 /*
- * Get more memory (at the top of the heap) using sbrk, and 
- * return a pointer to it.
+ * Move the heap top by DELTA bytes using sbrk. Returns the old top,
+ * or 0 if sbrk failed.
  */
 static
-void *
-__malloc_sbrk(size_t size)
+uintptr_t
+__malloc_sbrk(intptr_t delta)
 {
 	void *x;
 
-	x = sbrk(size);
+	x = sbrk(delta);
 	if (x == (void *)-1) {
-		return NULL;
+		return 0;
 	}
 
 	if ((uintptr_t)x != __heaptop) {
@@ -275,55 +328,269 @@ __malloc_sbrk(size_t size)
 		     (unsigned long) __heaptop,
 		     (unsigned long) (uintptr_t) x);
 	}
-	__heaptop += size;
-	return x;
+	__heaptop += delta;
+	return (uintptr_t)x;
 }
 
 /*
- * Make a new (free) block from the block passed in, leaving size
- * bytes for data in the current block. size must be a multiple of
- * MBLOCKSIZE.
- *
- * Only split if the excess space is at least twice the blocksize -
- * one blocksize to hold a header and one for data.
+ * Get a span of NPAGES pages: first fit from the free spans, or
+ * else from the top of the heap, reusing a free span that's already
+ * there if there is one.
+ */
+static
+struct mpage *
+__malloc_getpages(size_t npages)
+{
+	struct mpage *mp, *last, *rest;
+	uintptr_t x;
+
+	last = NULL;
+	for (mp = __malloc_freespans; mp != NULL; mp = mp->mp_next) {
+		if (mp->mp_npages >= npages) {
+			break;
+		}
+		last = mp;
+	}
+
+	if (mp != NULL) {
+		if (mp->mp_npages > npages) {
+			/* Leave the rest where this span was in the list. */
+			rest = (struct mpage *)((uintptr_t)mp +
+						npages * MPAGESIZE);
+			rest->mp_magic = MMAGIC_FREE;
+			rest->mp_npages = mp->mp_npages - npages;
+			rest->mp_next = mp->mp_next;
+			rest->mp_prev = mp->mp_prev;
+			if (rest->mp_next != NULL) {
+				rest->mp_next->mp_prev = rest;
+			}
+			if (rest->mp_prev != NULL) {
+				rest->mp_prev->mp_next = rest;
+			}
+			else {
+				__malloc_freespans = rest;
+			}
+			mp->mp_next = mp->mp_prev = NULL;
+		}
+		else {
+			__malloc_unlink(&__malloc_freespans, mp);
+		}
+		mp->mp_npages = npages;
+		return mp;
+	}
+
+	if (last != NULL && M_END(last) == __heaptop) {
+		/* Grow the free span at the top of the heap. */
+		if (__malloc_sbrk((npages - last->mp_npages) * MPAGESIZE)
+		    == 0) {
+			return NULL;
+		}
+		__malloc_unlink(&__malloc_freespans, last);
+		last->mp_npages = npages;
+		return last;
+	}
+
+	if (npages > ((size_t)-1 >> 1) / MPAGESIZE) {
+		/* Too big for sbrk's signed argument. */
+		return NULL;
+	}
+	x = __malloc_sbrk(npages * MPAGESIZE);
+	if (x == 0) {
+		return NULL;
+	}
+	mp = (struct mpage *)x;
+	mp->mp_npages = npages;
+	mp->mp_next = mp->mp_prev = NULL;
+	return mp;
+}
+
+/*
+ * Check if MP is a page of small blocks with none in use that's only
+ * being kept because it's the last page of its class. Works for any
+ * page-aligned MP in the heap, not just headers.
+ */
+static
+int
+__malloc_isidle(struct mpage *mp)
+{
+	unsigned c = mp->mp_class;
+
+	return mp->mp_magic == MMAGIC_SMALL && c < MNCLASSES &&
+		__malloc_partial[c] == mp && mp->mp_next == NULL &&
+		mp->mp_nfree == M_PERPAGE(c);
+}
+
+/*
+ * If the free space at the top of the heap, counting idle class pages
+ * as free, comes to MTRIMPAGES pages or more, give it back.
  */
 static
 void
-__malloc_split(struct mheader *mh, size_t size)
+__malloc_trim(void)
 {
-	struct mheader *mhnext, *mhnew;
-	size_t oldsize;
+	struct mpage *mp, *last;
+	uintptr_t top, x;
 
-	if (size % MBLOCKSIZE != 0) {
-		errx(1, "malloc: Internal error (size %lu passed to split)",
-		     (unsigned long) size);
+	last = NULL;
+	for (mp = __malloc_freespans; mp != NULL; mp = mp->mp_next) {
+		last = mp;
 	}
 
-	if (M_SIZE(mh) - size < 2*MBLOCKSIZE) {
-		/* no room */
+	/* Find how far down the free space goes. */
+	top = __heaptop;
+	while (top > __heapbase) {
+		if (last != NULL && M_END(last) == top) {
+			top = (uintptr_t)last;
+			last = last->mp_prev;
+		}
+		else if (__malloc_isidle((struct mpage *)(top - MPAGESIZE))) {
+			top -= MPAGESIZE;
+		}
+		else {
+			break;
+		}
+	}
+	if ((__heaptop - top) / MPAGESIZE < MTRIMPAGES) {
 		return;
 	}
 
-	mhnext = M_NEXT(mh);
+	/* Take it all off the lists... */
+	if (last != NULL) {
+		last->mp_next = NULL;
+	}
+	else {
+		__malloc_freespans = NULL;
+	}
+	for (x = top; x < __heaptop; x = M_END(mp)) {
+		mp = (struct mpage *)x;
+		if (mp->mp_magic == MMAGIC_SMALL) {
+			__malloc_unlink(&__malloc_partial[mp->mp_class], mp);
+		}
+	}
 
-	oldsize = M_SIZE(mh);
-	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
-	
-	mhnew = M_NEXT(mh);
-	if (mhnew==mhnext) {
-		errx(1, "malloc: Internal error (split screwed up?)");
+	/* ...and give it back. */
+	if (__malloc_sbrk(-(intptr_t)(__heaptop - top)) == 0) {
+		errx(1, "malloc: sbrk failed trimming heap");
 	}
+}
 
-	mhnew->mh_prevblock = M_MKFIELD(size + MBLOCKSIZE);
-	mhnew->mh_pad = 0;
-	mhnew->mh_magic1 = MMAGIC;
-	mhnew->mh_nextblock = M_MKFIELD(oldsize - size);
-	mhnew->mh_inuse = 0;
-	mhnew->mh_magic2 = MMAGIC;
+/*
+ * Give back the span MP: put it on the free span list, merging it
+ * with its neighbours, and trim the heap if that leaves enough free
+ * space at the top.
+ */
+static
+void
+__malloc_putpages(struct mpage *mp)
+{
+	struct mpage *prev, *next;
+
+	mp->mp_magic = MMAGIC_FREE;
 
-	if (mhnext != (struct mheader *) __heaptop) {
-		mhnext->mh_prevblock = mhnew->mh_nextblock;
+	/* Find where it goes. */
+	prev = NULL;
+	for (next = __malloc_freespans; next != NULL; next = next->mp_next) {
+		if ((uintptr_t)next > (uintptr_t)mp) {
+			break;
+		}
+		prev = next;
+	}
+
+	/* Merge with the span above, or link in before it. */
+	if (next != NULL && M_END(mp) == (uintptr_t)next) {
+		mp->mp_npages += next->mp_npages;
+		mp->mp_next = next->mp_next;
+		if (mp->mp_next != NULL) {
+			mp->mp_next->mp_prev = mp;
+		}
+		next->mp_magic = 0;
+	}
+	else {
+		mp->mp_next = next;
+		if (next != NULL) {
+			next->mp_prev = mp;
+		}
 	}
+
+	/* Merge with the span below, or link in after it. */
+	if (prev != NULL && M_END(prev) == (uintptr_t)mp) {
+		prev->mp_npages += mp->mp_npages;
+		prev->mp_next = mp->mp_next;
+		if (prev->mp_next != NULL) {
+			prev->mp_next->mp_prev = prev;
+		}
+		mp->mp_magic = 0;
+		mp = prev;
+	}
+	else {
+		mp->mp_prev = prev;
+		if (prev != NULL) {
+			prev->mp_next = mp;
+		}
+		else {
+			__malloc_freespans = mp;
+		}
+	}
+
+	if (M_END(mp) == __heaptop) {
+		__malloc_trim();
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Set up a fresh page for size class C, with all its blocks free.
+ */
+static
+void
+__malloc_newpage(struct mpage *mp, unsigned c)
+{
+	size_t size, n, i;
+	char *blk;
+
+	size = __malloc_sizes[c];
+	n = M_PERPAGE(c);
+
+	mp->mp_magic = MMAGIC_SMALL;
+	mp->mp_class = c;
+	mp->mp_nfree = n;
+
+	blk = M_FIRST(mp);
+	mp->mp_freelist = blk;
+	for (i=0; i<n-1; i++) {
+		*(void **)blk = blk + size;
+		blk += size;
+	}
+	*(void **)blk = NULL;
+}
+
+/*
+ * Allocate a block of size class C.
+ */
+static
+void *
+__malloc_small(unsigned c)
+{
+	struct mpage *mp;
+	void *blk;
+
+	mp = __malloc_partial[c];
+	if (mp == NULL) {
+		mp = __malloc_getpages(1);
+		if (mp == NULL) {
+			return NULL;
+		}
+		__malloc_newpage(mp, c);
+		__malloc_push(&__malloc_partial[c], mp);
+	}
+
+	blk = mp->mp_freelist;
+	mp->mp_freelist = *(void **)blk;
+	if (--mp->mp_nfree == 0) {
+		__malloc_unlink(&__malloc_partial[c], mp);
+	}
+	return blk;
 }
 
 /*
@@ -332,9 +599,9 @@ __malloc_split(struct mheader *mh, size_t size)
 void *
 malloc(size_t size)
 {
-	struct mheader *mh;
-	uintptr_t i;
-	size_t rightprevblock;
+	struct mpage *mp;
+	size_t npages;
+	void *ret;
 
 	if (__heapbase==0) {
 		__malloc_init();
@@ -351,84 +618,35 @@ malloc(size_t size)
 	__malloc_dump();
 #endif
 
-	/* Round size up to an integral number of blocks. */
-	size = ((size + MBLOCKSIZE - 1) & ~(size_t)(MBLOCKSIZE-1));
-
-	/*
-	 * First-fit search algorithm for available blocks.
-	 * Check to make sure the next/previous sizes all agree.
-	 */
-	rightprevblock = 0;
-	for (i=__heapbase; i<__heaptop; i += M_NEXTOFF(mh)) {
-		mh = (struct mheader *) i;
-		if (!M_OK(mh)) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad magic bits",
-			     (unsigned long) i);
-		}
-		if (mh->mh_prevblock != rightprevblock) {
-			errx(1, "malloc: Heap corrupt; header at 0x%lx"
-			     " has bad previous-block size %lu "
-			     "(should be %lu)",
-			     (unsigned long) i, 
-			     (unsigned long) mh->mh_prevblock << MBLOCKSHIFT,
-			     (unsigned long) rightprevblock << MBLOCKSHIFT);
-		}
-		rightprevblock = mh->mh_nextblock;
-
-		/* Can't allocate a block that's in use. */
-		if (mh->mh_inuse) {
-			continue;
-		}
-
-		/* Can't allocate a block that isn't big enough. */
-		if (M_SIZE(mh) < size) {
-			continue;
-		}
-
-		/* Try splitting block. */
-		__malloc_split(mh, size);
-
-		/*
-		 * Now, allocate.
-		 */
-		mh->mh_inuse = 1;
-
-#ifdef MALLOCDEBUG
-		warnx("malloc: allocating at %p", M_DATA(mh));
-		__malloc_dump();
-#endif
-		return M_DATA(mh);
+	if (size <= MSMALLMAX) {
+		ret = __malloc_small(
+			__malloc_classof[(size + MALIGN - 1) / MALIGN]);
 	}
-	if (i!=__heaptop) {
-		errx(1, "malloc: Heap corrupt; ran off end");
+	else if (size > (size_t)-1 - MHDRSIZE - MPAGESIZE) {
+		ret = NULL;
 	}
-
-	/*
-	 * Didn't find anything. Expand the heap.
-	 */
-
-	mh = __malloc_sbrk(size + MBLOCKSIZE);
-	if (mh == NULL) {
-		return NULL;
+	else {
+		npages = (size + MHDRSIZE + MPAGESIZE - 1) / MPAGESIZE;
+		mp = __malloc_getpages(npages);
+		if (mp == NULL) {
+			ret = NULL;
+		}
+		else {
+			mp->mp_magic = MMAGIC_LARGE;
+			ret = M_FIRST(mp);
+		}
 	}
 
-	mh->mh_prevblock = rightprevblock;
-	mh->mh_magic1 = MMAGIC;
-	mh->mh_magic2 = MMAGIC;
-	mh->mh_pad = 0;
-	mh->mh_inuse = 1;
-	mh->mh_nextblock = M_MKFIELD(size + MBLOCKSIZE);
-
 #ifdef MALLOCDEBUG
-	warnx("malloc: allocating at %p", M_DATA(mh));
+	warnx("malloc: allocating at %p", ret);
 	__malloc_dump();
 #endif
-	return M_DATA(mh);
+	return ret;
 }
 
 ////////////////////////////////////////////////////////////
 
+#ifdef MALLOCDEBUG
 /*
  * Clear a range of memory with 0xdeadbeef.
  * ptr must be suitably aligned.
@@ -443,36 +661,62 @@ __malloc_deadbeef(void *ptr, size_t size)
 		x[i] = 0xdeadbeef;
 	}
 }
+#endif
 
 /*
- * Attempt to merge two adjacent blocks (mh below mhnext).
+ * Free a block of a small-block page.
  */
 static
 void
-__malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
+__malloc_freesmall(struct mpage *mp, void *x)
 {
-	struct mheader *mhnextnext;
+	unsigned c = mp->mp_class;
 
-	if (mh->mh_nextblock != mhnext->mh_prevblock) {
-		errx(1, "free: Heap corrupt (%p and %p inconsistent)",
-		     mh, mhnext);
-	}
-	if (mh->mh_inuse || mhnext->mh_inuse) {
-		/* can't merge */
-		return;
+	if (c >= MNCLASSES ||
+	    ((uintptr_t)x - (uintptr_t)M_FIRST(mp)) % __malloc_sizes[c] != 0 ||
+	    (uintptr_t)x < (uintptr_t)M_FIRST(mp)) {
+		errx(1, "free: Invalid pointer %p freed (not a block)", x);
 	}
 
-	mhnextnext = M_NEXT(mhnext);
+#ifdef MALLOCDEBUG
+	{
+		void *blk;
+		for (blk = mp->mp_freelist; blk != NULL; blk = *(void **)blk) {
+			if (blk == x) {
+				errx(1, "free: Invalid pointer %p freed "
+				     "(already free)", x);
+			}
+		}
+	}
+	__malloc_deadbeef(x, __malloc_sizes[c]);
+#endif
 
-	mh->mh_nextblock = M_MKFIELD(MBLOCKSIZE + M_SIZE(mh) +
-				     MBLOCKSIZE + M_SIZE(mhnext));
+	*(void **)x = mp->mp_freelist;
+	mp->mp_freelist = x;
+	mp->mp_nfree++;
 
-	if (mhnextnext != (struct mheader *)__heaptop) {
-		mhnextnext->mh_prevblock = mh->mh_nextblock;
+	if (mp->mp_nfree == 1) {
+		/* It was full. */
+		__malloc_push(&__malloc_partial[c], mp);
+	}
+	else if (mp->mp_nfree == M_PERPAGE(c)) {
+		/*
+		 * Entirely free. Keep it if it's the class's only page,
+		 * so alternating malloc/free doesn't churn; but then it
+		 * may be all that's keeping the heap from being trimmed.
+		 */
+		if (__malloc_isidle(mp)) {
+			if (M_END(mp) == __heaptop ||
+			    ((struct mpage *)M_END(mp))->mp_magic ==
+			    MMAGIC_FREE) {
+				__malloc_trim();
+			}
+		}
+		else {
+			__malloc_unlink(&__malloc_partial[c], mp);
+			__malloc_putpages(mp);
+		}
 	}
-
-	/* Deadbeef out the memory used by the now-obsolete header */
-	__malloc_deadbeef(mhnext, sizeof(struct mheader));
 }
 
 /*
@@ -481,7 +725,7 @@ __malloc_trymerge(struct mheader *mh, struct mheader *mhnext)
 void
 free(void *x)
 {
-	struct mheader *mh, *mhnext, *mhprev;
+	struct mpage *mp;
 
 	if (x==NULL) {
 		/* safest practice */
@@ -505,35 +749,102 @@ free(void *x)
 	__malloc_dump();
 #endif
 
-	mh = ((struct mheader *)x)-1;
-	if (!M_OK(mh)) {
+	mp = M_PAGE(x);
+	switch (mp->mp_magic) {
+	    case MMAGIC_SMALL:
+		__malloc_freesmall(mp, x);
+		break;
+	    case MMAGIC_LARGE:
+		if (x != M_FIRST(mp)) {
+			errx(1, "free: Invalid pointer %p freed "
+			     "(not a block)", x);
+		}
+#ifdef MALLOCDEBUG
+		__malloc_deadbeef(x, mp->mp_npages * MPAGESIZE - MHDRSIZE);
+#endif
+		__malloc_putpages(mp);
+		break;
+	    case MMAGIC_FREE:
+		errx(1, "free: Invalid pointer %p freed (already free)", x);
+		break;
+	    default:
 		errx(1, "free: Invalid pointer %p freed (corrupt header)", x);
+		break;
 	}
 
-	if (!mh->mh_inuse) {
-		errx(1, "free: Invalid pointer %p freed (already free)", x);
-	}
+#ifdef MALLOCDEBUG
+	warnx("free: freed %p", x);
+	__malloc_dump();
+#endif
+}
 
-	/* mark it free */
-	mh->mh_inuse = 0;
+////////////////////////////////////////////////////////////
 
-	/* wipe it */
-	__malloc_deadbeef(M_DATA(mh), M_SIZE(mh));
+/*
+ * realloc. A block stays where it is if the new size is in the same
+ * size class, or for a large block, if it still fits and would use at
+ * least half the span. Otherwise it moves.
+ */
+void *
+realloc(void *x, size_t size)
+{
+	struct mpage *mp;
+	size_t have, npages;
+	int keep;
+	void *ret;
 
-	/* Try merging with the block above (but not if we're at the top) */
-	mhnext = M_NEXT(mh);
-	if (mhnext != (struct mheader *)__heaptop) {
-		__malloc_trymerge(mh, mhnext);
+	if (x==NULL) {
+		return malloc(size);
+	}
+	if (size==0) {
+		free(x);
+		return NULL;
 	}
 
-	/* Try merging with the block below (but not if we're at the bottom) */
-	if (mh != (struct mheader *)__heapbase) {
-		mhprev = M_PREV(mh);
-		__malloc_trymerge(mhprev, mh);
+	if ((uintptr_t)x < __heapbase || (uintptr_t)x >= __heaptop) {
+		errx(1, "realloc: Invalid pointer %p (out of range)", x);
 	}
 
-#ifdef MALLOCDEBUG
-	warnx("free: freed %p", x);
-	__malloc_dump();
-#endif
+	have = 0;
+	keep = 0;
+	mp = M_PAGE(x);
+	switch (mp->mp_magic) {
+	    case MMAGIC_SMALL:
+		if (mp->mp_class >= MNCLASSES) {
+			errx(1, "realloc: Invalid pointer %p "
+			     "(corrupt header)", x);
+		}
+		have = __malloc_sizes[mp->mp_class];
+		keep = size <= MSMALLMAX && __malloc_classof[
+			(size + MALIGN - 1) / MALIGN] == mp->mp_class;
+		break;
+	    case MMAGIC_LARGE:
+		if (x != M_FIRST(mp)) {
+			errx(1, "realloc: Invalid pointer %p (not a block)",
+			     x);
+		}
+		have = mp->mp_npages * MPAGESIZE - MHDRSIZE;
+		npages = (size + MHDRSIZE + MPAGESIZE - 1) / MPAGESIZE;
+		keep = size > MSMALLMAX && size <= have &&
+			npages * 2 >= mp->mp_npages;
+		break;
+	    case MMAGIC_FREE:
+		errx(1, "realloc: Invalid pointer %p (already free)", x);
+		break;
+	    default:
+		errx(1, "realloc: Invalid pointer %p (corrupt header)", x);
+		break;
+	}
+
+	if (keep) {
+		return x;
+	}
+
+	ret = malloc(size);
+	if (ret == NULL) {
+		return NULL;
+	}
+	memcpy(ret, x, size < have ? size : have);
+	free(x);
+	return ret;
 }
@@ -0,0 +1,220 @@
+/*
+ * vm-malloc: exercise malloc, free and realloc.
+ *
+ * Checks that blocks of every size class, and large blocks, are
+ * aligned and don't overlap; that freed neighbouring spans are merged;
+ * that freed space is reused rather than the heap growing; that
+ * realloc keeps the contents; and that the heap shrinks again once
+ * everything is freed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define PAGE_SIZE	4096
+#define ALIGN		16
+#define NBLOCKS		64
+
+/* Sizes to try: around the ends of several size classes, then large. */
+static const size_t sizes[] = {
+	1, 15, 16, 17, 48, 100, 256, 300, 500, 700, 1000, 1008,
+	1009, 3000, 5000, 20000,
+};
+#define NSIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static char *blocks[NBLOCKS];
+
+static
+char *
+heaptop(void)
+{
+	return sbrk(0);
+}
+
+static
+void
+fail(const char *msg, size_t size)
+{
+	printf("FAILED %s (size %lu)\n", msg, (unsigned long)size);
+	exit(1);
+}
+
+static
+void
+fill(char *p, size_t size, unsigned seed)
+{
+	size_t i;
+
+	for (i=0; i<size; i++) {
+		p[i] = (char)(seed + i);
+	}
+}
+
+static
+int
+check(const char *p, size_t size, unsigned seed)
+{
+	size_t i;
+
+	for (i=0; i<size; i++) {
+		if (p[i] != (char)(seed + i)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Allocate NBLOCKS blocks of SIZE, check them and free them, odd ones
+ * first. Returns the heap top with all of them allocated.
+ */
+static
+char *
+sizeround(size_t size)
+{
+	char *peak;
+	unsigned i;
+
+	for (i=0; i<NBLOCKS; i++) {
+		blocks[i] = malloc(size);
+		if (blocks[i] == NULL) {
+			fail("malloc returned NULL", size);
+		}
+		if ((unsigned long)blocks[i] % ALIGN != 0) {
+			fail("block not aligned", size);
+		}
+		fill(blocks[i], size, i);
+	}
+	peak = heaptop();
+
+	/* Any overlap would have overwritten someone's pattern. */
+	for (i=0; i<NBLOCKS; i++) {
+		if (!check(blocks[i], size, i)) {
+			fail("block contents overwritten", size);
+		}
+	}
+
+	for (i=1; i<NBLOCKS; i+=2) {
+		free(blocks[i]);
+	}
+	for (i=0; i<NBLOCKS; i+=2) {
+		free(blocks[i]);
+	}
+	return peak;
+}
+
+/*
+ * Free eight adjacent two-page blocks in a scattered order; they
+ * should merge into one span that a sixteen-page request fits in.
+ */
+static
+void
+coalesce(void)
+{
+	static const unsigned order[8] = { 3, 5, 1, 7, 0, 6, 2, 4 };
+	char *fence, *big;
+	unsigned i;
+
+	for (i=0; i<8; i++) {
+		blocks[i] = malloc(2 * PAGE_SIZE - 100);
+		if (blocks[i] == NULL) {
+			fail("malloc returned NULL", 2 * PAGE_SIZE - 100);
+		}
+	}
+	/* Keep the freed span from being handed back to the kernel. */
+	fence = malloc(PAGE_SIZE);
+	if (fence == NULL) {
+		fail("malloc returned NULL", PAGE_SIZE);
+	}
+
+	for (i=0; i<8; i++) {
+		free(blocks[order[i]]);
+	}
+
+	big = malloc(16 * PAGE_SIZE - 100);
+	if (big != blocks[0]) {
+		printf("FAILED freed spans not merged: got %p, expected %p\n",
+		       big, blocks[0]);
+		exit(1);
+	}
+	free(big);
+	free(fence);
+	printf("coalescing ok\n");
+}
+
+static
+void
+reallocs(void)
+{
+	static const size_t steps[] = { 40, 200, 1008, 3000, 50000, 1500, 10 };
+	char *p, *q, *r;
+	size_t have;
+	unsigned i;
+
+	p = realloc(NULL, 10);
+	if (p == NULL) {
+		fail("realloc(NULL) returned NULL", 10);
+	}
+	fill(p, 10, 7);
+	have = 10;
+
+	for (i=0; i<sizeof(steps)/sizeof(steps[0]); i++) {
+		p = realloc(p, steps[i]);
+		if (p == NULL) {
+			fail("realloc returned NULL", steps[i]);
+		}
+		if (!check(p, have < steps[i] ? have : steps[i], 7)) {
+			fail("realloc lost the contents", steps[i]);
+		}
+		fill(p, steps[i], 7);
+		have = steps[i];
+	}
+
+	/* Growing within the size class shouldn't move the block. */
+	q = malloc(100);
+	r = realloc(q, 120);
+	if (r != q) {
+		fail("realloc moved a block within its class", 120);
+	}
+	free(r);
+
+	if (realloc(p, 0) != NULL) {
+		fail("realloc to 0 didn't free", 0);
+	}
+	printf("realloc ok\n");
+}
+
+int
+main()
+{
+	char *start, *peak1, *peak2;
+	unsigned i;
+
+	/* First, while the heap is fresh and the layout is predictable. */
+	coalesce();
+
+	for (i=0; i<NSIZES; i++) {
+		start = heaptop();
+		peak1 = sizeround(sizes[i]);
+
+		/* Everything's free, so the heap should have shrunk back. */
+		if (heaptop() >= start + 4 * PAGE_SIZE) {
+			fail("heap not trimmed after freeing", sizes[i]);
+		}
+
+		/* The same again should reuse the space, not grow. */
+		peak2 = sizeround(sizes[i]);
+		if (peak2 > peak1) {
+			fail("freed space not reused", sizes[i]);
+		}
+		printf("size %5lu ok, heap grew by %lu pages\n",
+		       (unsigned long)sizes[i],
+		       (unsigned long)(peak1 - start) / PAGE_SIZE);
+	}
+
+	reallocs();
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
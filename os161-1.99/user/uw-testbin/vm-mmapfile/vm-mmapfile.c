@@ -0,0 +1,149 @@
+/*
+ * vm-mmapfile: map a file shared and private, write through both
+ * mappings, and check what the file ends up with.
+ *
+ * Writes through the shared mapping go into the file's cached pages,
+ * so read() sees them at once, and they reach the disk by fsync. The
+ * private mapping starts out seeing the same pages, but writes through
+ * it stay private.
+ *
+ * Mapped files come from the page cache, so the file has to be on an
+ * SFS volume; the name can be given as the argument.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE	4096
+#define PAGES		4
+#define FILENAME	"mmapfile"
+
+static char buf[PAGE_SIZE];
+
+static
+void
+fail(const char *msg)
+{
+	printf("FAILED %s\n", msg);
+	exit(1);
+}
+
+/* What byte 0 of page P should be once the shared writes are done */
+static
+char
+written(unsigned p)
+{
+	return p % 2 == 0 ? (char)('A' + p) : (char)('a' + p);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *name;
+	char *shared, *priv, *part;
+	unsigned p, i;
+	int fd, fd2;
+
+	name = argc > 1 ? argv[1] : FILENAME;
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0664);
+	if (fd < 0) {
+		fail("open");
+	}
+	for (p=0; p<PAGES; p++) {
+		for (i=0; i<PAGE_SIZE; i++) {
+			buf[i] = (char)('a' + p);
+		}
+		if (write(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			fail("write");
+		}
+	}
+
+	shared = mmap(NULL, PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		      MAP_SHARED, fd, 0);
+	if (shared == MAP_FAILED) {
+		fail("mmap MAP_SHARED");
+	}
+	for (p=0; p<PAGES; p++) {
+		for (i=0; i<PAGE_SIZE; i++) {
+			if (shared[p * PAGE_SIZE + i] != (char)('a' + p)) {
+				fail("shared mapping doesn't match the file");
+			}
+		}
+	}
+	for (p=0; p<PAGES; p+=2) {
+		shared[p * PAGE_SIZE] = written(p);
+	}
+
+	/* Another open file reads the same pages. */
+	fd2 = open(name, O_RDONLY);
+	if (fd2 < 0) {
+		fail("second open");
+	}
+	if (read(fd2, buf, PAGE_SIZE) != PAGE_SIZE || buf[0] != written(0)) {
+		fail("read doesn't see a write through the shared mapping");
+	}
+	close(fd2);
+
+	priv = mmap(NULL, PAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, fd, 0);
+	if (priv == MAP_FAILED) {
+		fail("mmap MAP_PRIVATE");
+	}
+	for (p=0; p<PAGES; p++) {
+		if (priv[p * PAGE_SIZE] != written(p)) {
+			fail("private mapping doesn't see the shared writes");
+		}
+	}
+	priv[1] = '!';
+	priv[(PAGES - 1) * PAGE_SIZE + 1] = '!';
+	if (shared[1] != 'a' ||
+	    shared[(PAGES - 1) * PAGE_SIZE + 1] != (char)('a' + PAGES - 1)) {
+		fail("private write seen through the shared mapping");
+	}
+
+	/* A mapping from partway into the file */
+	part = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, fd,
+		    2 * PAGE_SIZE);
+	if (part == MAP_FAILED) {
+		fail("mmap at an offset");
+	}
+	if (part[0] != written(2) || part[1] != (char)('a' + 2)) {
+		fail("mapping at an offset doesn't match the file");
+	}
+
+	if (fsync(fd) < 0) {
+		fail("fsync");
+	}
+	if (munmap(part, PAGE_SIZE) < 0 ||
+	    munmap(priv, PAGES * PAGE_SIZE) < 0 ||
+	    munmap(shared, PAGES * PAGE_SIZE) < 0) {
+		fail("munmap");
+	}
+	close(fd);
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0) {
+		fail("reopen");
+	}
+	for (p=0; p<PAGES; p++) {
+		if (read(fd, buf, PAGE_SIZE) != PAGE_SIZE) {
+			fail("read back");
+		}
+		if (buf[0] != written(p)) {
+			fail("shared write didn't reach the file");
+		}
+		for (i=1; i<PAGE_SIZE; i++) {
+			if (buf[i] != (char)('a' + p)) {
+				fail("file has something it shouldn't");
+			}
+		}
+	}
+	close(fd);
+
+	printf("SUCCEEDED\n");
+	return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * vm-stats: read the VM counters before and after touching some fresh
+ * pages, print what changed, and check the page faults were counted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/vmstats.h>
+
+#define PAGE_SIZE (4096)
+#define PAGES     (64)
+#define SIZE      (PAGE_SIZE * PAGES / sizeof(int))
+
+unsigned int array[SIZE];
+
+static const char *names[VMSTAT_COUNT] = {
+	"TLB faults", "  with free", "  with replace", "TLB invalidations",
+	"TLB reloads", "Page faults (zeroed)", "Page faults (disk)",
+	"  from ELF", "  from swap", "Swap writes",
+	"TLB invalidations avoided", "Shootdown IPIs",
+	"Shootdown invalidations", "Preload hits", "Preload misses",
+	"COW copies", "COW reuses", "Swap frees", "Swap full",
+	"Page cache hits", "Page cache misses", "Zero page writes",
+};
+
+int
+main()
+{
+	unsigned before[VMSTAT_COUNT], after[VMSTAT_COUNT];
+	unsigned int i = 0;
+	int n;
+
+	n = __vmstats(before, VMSTAT_COUNT);
+	if (n != VMSTAT_COUNT) {
+		printf("FAILED __vmstats returned %d, expected %d\n",
+		       n, VMSTAT_COUNT);
+		exit(1);
+	}
+
+	for (i=0; i<SIZE; i++) {
+		array[i] = i;
+	}
+
+	__vmstats(after, VMSTAT_COUNT);
+
+	for (i=0; i<VMSTAT_COUNT; i++) {
+		printf("%-26s %10u\n", names[i], after[i] - before[i]);
+	}
+
+	for (i=0; i<SIZE; i++) {
+		if (array[i] != i) {
+			printf("FAILED array[%d] = %u != %d\n", i, array[i], i);
+			exit(1);
+		}
+	}
+
+	/*
+	 * Each page of the array is new, so faulting it in counts as
+	 * zeroed or disk. Other programs may add faults, never remove.
+	 */
+	if (after[VMSTAT_PAGE_FAULT_ZERO] - before[VMSTAT_PAGE_FAULT_ZERO] +
+	    after[VMSTAT_PAGE_FAULT_DISK] - before[VMSTAT_PAGE_FAULT_DISK]
+	    < PAGES) {
+		printf("FAILED fewer than %d page faults counted\n", PAGES);
+		exit(1);
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}
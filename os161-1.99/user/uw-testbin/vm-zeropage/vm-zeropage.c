@@ -0,0 +1,82 @@
+/*
+ * vm-zeropage: read every page of a large, never-written array, then
+ * write a few of them.
+ *
+ * Pages that are only read should all map the one shared zero page,
+ * so reading an array several times the size of physical memory
+ * takes no frames and pushes nothing out to swap. Only the pages that
+ * are written should get frames of their own, each counted once as a
+ * zero page write.
+ *
+ * The counters are system-wide, so other programs running at the same
+ * time can add to them. The read phase only reports its counts; the
+ * contents check at the end is what shows the reads saw zeros.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/vmstats.h>
+
+#define PAGE_SIZE	4096
+#define PAGES		1024	/* 4M: more than the machine's memory */
+#define STRIDE		64	/* write one page in this many */
+
+char sparse[PAGES * PAGE_SIZE];
+
+static unsigned before[VMSTAT_COUNT], after[VMSTAT_COUNT];
+
+static
+unsigned
+delta(int which)
+{
+	return after[which] - before[which];
+}
+
+int
+main()
+{
+	unsigned i, sum;
+
+	__vmstats(before, VMSTAT_COUNT);
+	sum = 0;
+	for (i=0; i<PAGES; i++) {
+		sum += sparse[i * PAGE_SIZE];
+	}
+	__vmstats(after, VMSTAT_COUNT);
+
+	if (sum != 0) {
+		printf("FAILED untouched pages don't read as zeros\n");
+		exit(1);
+	}
+	printf("read %u pages: %u zero-fill faults, %u swap writes\n",
+	       PAGES, delta(VMSTAT_PAGE_FAULT_ZERO),
+	       delta(VMSTAT_SWAP_FILE_WRITE));
+
+	__vmstats(before, VMSTAT_COUNT);
+	for (i=0; i<PAGES; i+=STRIDE) {
+		sparse[i * PAGE_SIZE + 1] = (char)(i / STRIDE + 1);
+	}
+	__vmstats(after, VMSTAT_COUNT);
+
+	printf("wrote %u pages: %u zero page writes, %u COW copies\n",
+	       PAGES / STRIDE, delta(VMSTAT_ZERO_BREAK),
+	       delta(VMSTAT_COW_COPY));
+	/* Other programs may add to the counts, never take away. */
+	if (delta(VMSTAT_ZERO_BREAK) < PAGES / STRIDE) {
+		printf("FAILED expected %u zero page writes\n",
+		       PAGES / STRIDE);
+		exit(1);
+	}
+
+	for (i=0; i<PAGES; i++) {
+		if (sparse[i * PAGE_SIZE] != 0 ||
+		    sparse[i * PAGE_SIZE + 1] !=
+		    (i % STRIDE == 0 ? (char)(i / STRIDE + 1) : 0)) {
+			printf("FAILED wrong contents in page %u\n", i);
+			exit(1);
+		}
+	}
+
+	printf("SUCCEEDED\n");
+	exit(0);
+}